@@ -0,0 +1,43 @@
+/*
+ * cancelsleep.c
+ * Sleep with thread cancellation enabled.
+ * Section threads run with cancellation disabled, so a SIGHUP reload
+ * can stop them only while they are idle, never holding dblock.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+unsigned int cancelsleep(unsigned int seconds)
+{
+	int     state;
+	unsigned int left;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+	pthread_testcancel();
+	left = sleep(seconds);
+	pthread_setcancelstate(state, NULL);
+
+	return (left);
+}
+
+int cancelusleep(unsigned int usec)
+{
+	int     ret;
+	int     state;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+	pthread_testcancel();
+	ret = usleep(usec);
+	pthread_setcancelstate(state, NULL);
+
+	return (ret);
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -25,22 +25,16 @@
 #define	SCANRATE        (ONE_MINUTE)
 #define	DRYSCAN         30							/* scanrate for dryrun */
 
-static inline bool LOW_RES(float target, float avail)
-{
-	return target > 0 && avail < target;
-}
-
-/* subtract from avail for extra space, reduce flapping */
-#define	PADDING			0.295f
-
 static bool getvfsstats(struct thread_info *, float *, float *);
 static void process_files(struct thread_info *, sqlite3 *);
 static void resource_report(struct thread_info *, bool, float, float);
 
-static char *sql_selectfiles = "SELECT db_dir, db_file\n \
+/* keyset pages: the rows after the last one seen, see process_files() */
+
+static char *sql_selectfiles = "SELECT db_dir, db_file, db_size, db_time, db_dirid\n \
     FROM  \"%s_dir\", \"%s_file\"\n \
-    WHERE db_dirid = db_id\n \
-    ORDER BY db_time\n \
+    WHERE db_dirid = db_id AND (db_time, db_dirid, db_file) > (?, ?, ?)\n \
+    ORDER BY db_time, db_dirid, db_file\n \
     LIMIT %d;";
 
 /* externals */
@@ -59,6 +53,8 @@ void   *dfsthread(void *arg)
 	float   pc_ffree = 0;							/* files free */
 	float   save_pc_bfree = 0;						/* saved blocks free */
 	float   save_pc_ffree = 0;						/* saved files free */
+	struct phaseclock pc;							/* phase timing */
+	struct phasesnap sn;							/* for the timing report */
 	struct statvfs svbuf;							/* filesystem status */
 	struct thread_info *ti = arg;					/* thread settings */
 	uint32_t nextid = 1;							/* db_id, db_dirid */
@@ -83,6 +79,7 @@ void   *dfsthread(void *arg)
 		return ((void *)0);
 
 	pthread_setname_np(pthread_self(), ti->ti_task);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	/* see cancelsleep */
 
 	findmnt(ti->ti_dirname, ti->ti_mountdir);		/* actual mountpoint */
 	memset(&svbuf, '\0', sizeof(svbuf));
@@ -125,12 +122,10 @@ void   *dfsthread(void *arg)
 		fprintf(stderr, "%s: monitor file: %s for retmin %d\n",
 				ti->ti_section, ti->ti_pcrestr, ti->ti_retmin);
 
-	/* monitor filesystem usage */
-	/* let's not start all the same thread types at once */
+	/* monitor filesystem usage, statvfs is cheap so check right away */
+	/* the seed spreads scans of threads sharing a low filesystem */
 
 	seed = (unsigned int)(time(NULL) ^ (uintptr_t) pthread_self());
-	srand(seed);
-	usleep(rand_r(&seed) & 0xFFFFF);
 
 	for(;;) {
 		if(getvfsstats(ti, &pc_bfree, &pc_ffree) == false)
@@ -163,27 +158,37 @@ void   *dfsthread(void *arg)
 			 * give the other thread(s) a chance to run first
 			 */
 
-			usleep(rand_r(&seed) & 0xFFFFF);
+			cancelusleep(rand_r(&seed) & 0xFFFFF);
 
-			pthread_mutex_lock(&dblock);
+			dblock_lock(ti);
+			phase_snap(ti, &sn);
 
 			if(findfile(ti, true, &nextid, ti->ti_dirname, db) > 0) {
 				/* process directories emptied by previous run */
 
-				if(ti->ti_rmdir)
+				if(ti->ti_rmdir) {
+					phase_start(&pc);
 					process_dirs(ti, db);
+					phase_stop(ti, PH_DIRS, &pc);
+				}
 
 				/* process matching files */
 
+				phase_start(&pc);
 				process_files(ti, db);
+				phase_stop(ti, PH_FILES, &pc);
 				runreport = true;
 			}
 
 			pthread_mutex_unlock(&dblock);
+
+			if(!ti->ti_terse)
+				phase_report(ti, &sn);
+
 			continue;
 		}
 
-		sleep(dryrun ? DRYSCAN : SCANRATE);
+		cancelsleep(dryrun ? DRYSCAN : SCANRATE);
 	}
 
 	/* notreached */
@@ -215,22 +220,38 @@ static void resource_report(struct thread_info *ti, bool lowres, float blk, floa
 
 static void process_files(struct thread_info *ti, sqlite3 *db)
 {
+	/*
+	 * remove the oldest files QUERYLIM rows at a time until dfsdecide()
+	 * is satisfied, dblock is released between pages
+	 */
+
+	bool    done = false;							/* stop removing */
 	char   *db_dir;									/* sql data */
 	char   *db_file;								/* sql data */
 	char    filename[PATH_MAX];						/* full pathname */
+	char    lastfile[PATH_MAX] = "";				/* keyset: last row seen */
 	char    stmt[BUFSIZ];							/* statement buffer */
 	extern bool dryrun;								/* dry run flag */
 	float   pc_bfree = 0;							/* blocks free */
 	float   pc_ffree = 0;							/* files free */
 	int     dfd;									/* dirname fd */
 	int     drcount = 0;							/* dry run count */
+	int     pages = 0;								/* keyset pages read */
+	char   *reason;									/* why */
+	int     rc = SQLITE_DONE;						/* return code */
+	sqlite3_int64 lastdir = 0;						/* keyset: last row seen */
+	sqlite3_int64 lasttime = INT64_MIN;				/* keyset: last row seen */
 	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
-	uint32_t filecount;								/* matching files */
+	struct expstate es = { 0 };						/* for dfsdecide */
+	unsigned long long db_size;						/* sql data */
 	uint32_t removed = 0;							/* matching files removed */
+	uint32_t rows;									/* rows in this page */
+	uint32_t walks;									/* scanwalks() at the first page */
+	uint64_t t;										/* query timing */
 
 	/* count all files */
 
-	if((filecount = count_files(ti, db)) < 1)
+	if((es.es_filecount = count_files(ti, db)) < 1)
 		return;
 
 	/* process all files */
@@ -248,56 +269,83 @@ static void process_files(struct thread_info *ti, sqlite3 *db)
 		return;
 	}
 
-	for(;;) {
-		/* check if usage dropped before we got here */
+	walks = scanwalks(ti);
 
-		if(getvfsstats(ti, &pc_bfree, &pc_ffree) == false)
-			break;
+	for(rows = QUERYLIM; !done && rows == QUERYLIM;) {
+		if(pages++) {								/* let the other sections in */
+			pthread_mutex_unlock(&dblock);
+			dblock_lock(ti);
+			sqlite3_reset(pstmt);
 
-		/*
-		 * subtract padding from available space to
-		 * provide a bit more space than the configured value
-		 */
+			if(scanwalks(ti) != walks)				/* a member walked, the keyset is stale */
+				break;
+		}
 
-		if(!LOW_RES(ti->ti_diskfree, pc_bfree - PADDING) &&
-		   !LOW_RES(ti->ti_inofree, pc_ffree - PADDING))
-			break;
+		sqlite3_bind_int64(pstmt, 1, lasttime);
+		sqlite3_bind_int64(pstmt, 2, lastdir);
+		sqlite3_bind_text(pstmt, 3, lastfile, -1, SQLITE_STATIC);
 
-		if(ti->ti_retmin && ti->ti_retmin >= filecount) {
-			fprintf(stderr, "%s: cannot clear space: retmin >= filecount: %d >= %d\n",
-					ti->ti_section, ti->ti_retmin, filecount);
+		for(rows = 0; !done; rows++) {
+			/* check if usage dropped before we got here */
 
-			sleep(SCANRATE);
-			break;
-		}
+			if(getvfsstats(ti, &pc_bfree, &pc_ffree) == false) {
+				done = true;
+				break;
+			}
 
-		if(dryrun && drcount++ == 10) {				/* dryrun doesn't remove anything */
-			if(!ti->ti_terse)
-				fprintf(stderr, "%s: ...\n", ti->ti_section);
+			if(dfsdecide(ti, &es, pc_bfree, pc_ffree, &reason) == EXP_STOP) {
+				if(reason) {
+					fprintf(stderr, "%s: cannot clear space: retmin >= filecount: %d >= %d\n",
+							ti->ti_section, ti->ti_retmin, es.es_filecount);
 
-			break;
-		}
+					sleep(SCANRATE);
+				}
 
-		if(sqlite3_step(pstmt) != SQLITE_ROW)
-			break;
+				done = true;
+				break;
+			}
 
-		db_dir = (char *)sqlite3_column_text(pstmt, 0);
-		db_file = (char *)sqlite3_column_text(pstmt, 1);
+			if(dryrun && drcount++ == 10) {			/* dryrun doesn't remove anything */
+				if(!ti->ti_terse)
+					fprintf(stderr, "%s: ...\n", ti->ti_section);
 
-		if(IS_NULL(db_file)) {
-			fprintf(stderr, "%s: null file entry in database\n", ti->ti_section);
-			continue;
-		}
+				done = true;
+				break;
+			}
 
-		if(NOT_NULL(db_dir))
-			snprintf(filename, PATH_MAX, "%s/%s/%s", ti->ti_dirname, db_dir, db_file);
-		else
-			snprintf(filename, PATH_MAX, "%s/%s", ti->ti_dirname, db_file);
+			t = monotime();
+			rc = sqlite3_step(pstmt);
+			phase_add(ti, PH_QUERY, monotime() - t);
+
+			if(rc != SQLITE_ROW)
+				break;
+
+			db_dir = (char *)sqlite3_column_text(pstmt, 0);
+			db_file = (char *)sqlite3_column_text(pstmt, 1);
+			db_size = (unsigned long long)sqlite3_column_int64(pstmt, 2);
+			lasttime = sqlite3_column_int64(pstmt, 3);
+			lastdir = sqlite3_column_int64(pstmt, 4);
+
+			if(IS_NULL(db_file)) {
+				fprintf(stderr, "%s: null file entry in database\n", ti->ti_section);
+				continue;
+			}
 
-		if(rmfile(ti, filename, "remove")) {
-			removed++;
-			filecount--;
+			strlcpy(lastfile, db_file, PATH_MAX);
+
+			if(NOT_NULL(db_dir))
+				snprintf(filename, PATH_MAX, "%s/%s/%s", ti->ti_dirname, db_dir, db_file);
+			else
+				snprintf(filename, PATH_MAX, "%s/%s", ti->ti_dirname, db_file);
+
+			if(rmfile(ti, filename, reason)) {
+				removed++;
+				expremoved(ti, &es, db_size);
+			}
 		}
+
+		if(rc != SQLITE_ROW && rc != SQLITE_DONE)
+			fprintf(stderr, "%s: sqlite3_step: %s\n", ti->ti_section, sqlite3_errmsg(db));
 	}
 
 	sqlite3_finalize(pstmt);
@@ -314,11 +362,6 @@ static void process_files(struct thread_info *ti, sqlite3 *db)
 				removed, removed == 1 ? "file" : "files");
 }
 
-static inline double percent(double x, double y)
-{
-	return (y != 0.0) ? (x / y) * 100.0 : 0.0;
-}
-
 static bool getvfsstats(struct thread_info *ti, float *blk, float *ino)
 {
 	struct statvfs svbuf;							/* filesystem status */
@@ -334,6 +377,9 @@ static bool getvfsstats(struct thread_info *ti, float *blk, float *ino)
 	if(ti->ti_inofree > 0)
 		*ino = (float)percent(svbuf.f_favail, svbuf.f_files);
 
+	METRIC_SET(ti, mt_bfree, percent(svbuf.f_bavail, svbuf.f_blocks) * 100);
+	METRIC_SET(ti, mt_ffree, percent(svbuf.f_favail, svbuf.f_files) * 100);
+
 	return (true);
 }
 
@@ -0,0 +1,116 @@
+/*
+ * expdecide.c
+ * What retention does with the next oldest matching file.
+ * expthread and dfsthread walk their files oldest first and ask here;
+ * pcrefind --stats asks the same questions of an in-memory list.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include "sentinal.h"
+
+enum expaction expdecide(struct thread_info *ti, struct expstate *es,
+						 off_t size, time_t mtime, char **reason)
+{
+	bool    expbysize;								/* consider expire size */
+	bool    expbytime;								/* consider expire time */
+
+	*reason = NULL;
+
+	if(ti->ti_retmin && es->es_filecount <= (uint32_t)ti->ti_retmin)
+		return (EXP_STOP);
+
+	/*
+	 * if expiresiz is set, use it, else true
+	 * if expire is set, use it, else false
+	 */
+
+	expbysize = !ti->ti_expiresiz || size > ti->ti_expiresiz;
+	expbytime = ti->ti_expire && mtime + ti->ti_expire < es->es_curtime;
+
+	/* files are sorted by time */
+
+	if(ti->ti_retmax && es->es_filecount > (uint32_t)ti->ti_retmax)
+		*reason = "retmax";							/* too many */
+
+	else if(ti->ti_dirlimit && es->es_dirbytes > (unsigned long long)ti->ti_dirlimit)
+		*reason = "dirlimit";						/* too much */
+
+	else if(expbysize && expbytime)
+		*reason = "expire";							/* too old */
+
+	else if(!expbytime)								/* done with the list */
+		return (EXP_STOP);
+
+	else											/* none of the above */
+		return (EXP_KEEP);
+
+	return (EXP_REMOVE);
+}
+
+enum expaction dfsdecide(struct thread_info *ti, struct expstate *es,
+						 float bfree, float ffree, char **reason)
+{
+	/*
+	 * subtract padding from available space to
+	 * provide a bit more space than the configured value
+	 */
+
+	*reason = NULL;
+
+	if(!LOW_RES(ti->ti_diskfree, bfree - PADDING) && !LOW_RES(ti->ti_inofree, ffree - PADDING))
+		return (EXP_STOP);
+
+	if(ti->ti_retmin && (uint32_t)ti->ti_retmin >= es->es_filecount) {
+		*reason = "retmin";							/* cannot clear space */
+		return (EXP_STOP);
+	}
+
+	*reason = "remove";
+	return (EXP_REMOVE);
+}
+
+bool exppending(struct thread_info *ti, struct expstate *es)
+{
+	/*
+	 * can expdecide() remove anything this pass, from the aggregates alone
+	 * the oldest file decides expire, without stats it may have expired
+	 */
+
+	time_t  oldest = ti->ti_stats.ts_valid ? ti->ti_stats.ts_oldest : 0;
+
+	if(ti->ti_retmin && es->es_filecount <= (uint32_t)ti->ti_retmin)
+		return (false);
+
+	if(ti->ti_retmax && es->es_filecount > (uint32_t)ti->ti_retmax)
+		return (true);
+
+	if(ti->ti_dirlimit && es->es_dirbytes > (unsigned long long)ti->ti_dirlimit)
+		return (true);
+
+	return (ti->ti_expire && oldest + ti->ti_expire < es->es_curtime);
+}
+
+void expremoved(struct thread_info *ti, struct expstate *es, unsigned long long size)
+{
+	struct tablestats *ts = &ti->ti_stats;			/* shorthand */
+
+	es->es_filecount--;
+
+	if(es->es_dirbytes >= size)
+		es->es_dirbytes -= size;
+	else
+		es->es_dirbytes = 0;
+
+	if(ts->ts_files)								/* the tree, not the tables */
+		ts->ts_files--;
+
+	ts->ts_bytes -= ts->ts_bytes >= size ? size : ts->ts_bytes;
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -23,17 +23,17 @@
 #define	SCANRATE		(ONE_MINUTE * 30)			/* faster seems too often */
 #define	DRYSCAN			30							/* scanrate for dryrun */
 
-static void process_files(struct thread_info *, sqlite3 *);
+static bool expone(struct thread_info *, struct expstate *, char *, char *,
+				   unsigned long long, uint32_t *);
 
-static char *sql_selectfiles = "SELECT db_dir, db_file, db_size\n \
+/* keyset pages: the rows after the last one seen, see expfiles() */
+
+static char *sql_selectfiles = "SELECT db_dir, db_file, db_size, db_time, db_dirid\n \
 	FROM  \"%s_dir\", \"%s_file\"\n \
-	WHERE db_dirid = db_id\n \
-	ORDER BY db_time\n \
+	WHERE db_dirid = db_id AND (db_time, db_dirid, db_file) > (?, ?, ?)\n \
+	ORDER BY db_time, db_dirid, db_file\n \
 	LIMIT %d;";
 
-static char *sql_selectbytes = "SELECT SUM(db_size)\n \
-	FROM  \"%s_file\";";
-
 /* externals */
 extern pthread_mutex_t dblock;						/* sqlite lock */
 
@@ -42,9 +42,10 @@ void   *expthread(void *arg)
 	char    ebuf[BUFSIZ];							/* expire buffer */
 	extern bool dryrun;								/* dry run flag */
 	extern sqlite3 *db;								/* db handle */
+	struct phaseclock pc;							/* phase timing */
+	struct phasesnap sn;							/* for the timing report */
 	struct thread_info *ti = arg;					/* thread settings */
 	uint32_t nextid = 1;							/* db_id, db_dirid */
-	uint32_t seed;									/* random */
 
 	/*
 	 * this thread requires:
@@ -67,6 +68,7 @@ void   *expthread(void *arg)
 		return ((void *)0);
 
 	pthread_setname_np(pthread_self(), ti->ti_task);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	/* see cancelsleep */
 
 	if(ti->ti_dirlimit)
 		fprintf(stderr, "%s: monitor directory: %s for dirlimit %s\n",
@@ -85,76 +87,82 @@ void   *expthread(void *arg)
 				ti->ti_section, ti->ti_pcrestr, ti->ti_retmax);
 
 	/* monitor expiration times */
-	/* let's not start all the same thread types at once */
+	/* first scans are staggered, see stagger() in sentinal.c */
 
-	seed = (uint32_t) ((uintptr_t) pthread_self() ^ (uintptr_t) time(NULL));
-	srand(seed);
-	usleep((useconds_t) (rand() & 0xffff));
+	cancelusleep(ti->ti_firstscan);
 
 	for(;;) {
-		pthread_mutex_lock(&dblock);
+		dblock_lock(ti);
+		phase_snap(ti, &sn);
 
 		if(findfile(ti, true, &nextid, ti->ti_dirname, db) > 0) {
 			/* process directories emptied by previous run */
 
-			if(ti->ti_rmdir)
+			if(ti->ti_rmdir) {
+				phase_start(&pc);
 				process_dirs(ti, db);
+				phase_stop(ti, PH_DIRS, &pc);
+			}
 
 			/* process matching files */
 
-			process_files(ti, db);
+			phase_start(&pc);
+			expfiles(ti, db);
+			phase_stop(ti, PH_FILES, &pc);
 		}
 
 		pthread_mutex_unlock(&dblock);
-		sleep(dryrun ? DRYSCAN : SCANRATE);
+
+		if(!ti->ti_terse)
+			phase_report(ti, &sn);
+
+		cancelsleep(dryrun ? DRYSCAN : SCANRATE);
 	}
 
 	/* notreached */
 	return ((void *)0);
 }
 
-static void process_files(struct thread_info *ti, sqlite3 *db)
+void expfiles(struct thread_info *ti, sqlite3 *db)
 {
-	char    filename[PATH_MAX];						/* full pathname */
+	/*
+	 * one expiration pass over the files found by findfile(), dblock held
+	 * QUERYLIM rows at a time, oldest first, until expdecide() says stop
+	 * dblock is released between pages for the other sections
+	 */
+
+	bool    done = false;							/* expdecide() said stop */
+	char    lastfile[PATH_MAX] = "";				/* keyset: last row seen */
 	char    stmt[BUFSIZ];							/* statement buffer */
 	char   *db_dir;									/* sql data */
 	char   *db_file;								/* sql data */
-	char   *reason;									/* why */
 	extern bool dryrun;								/* dry run flag */
 	int     dfd;									/* dirname fd */
 	int     drcount = 0;							/* dry run count */
-	bool    expbysize;								/* consider expire size */
-	bool    expbytime;								/* consider expire time */
+	int     pages = 0;								/* keyset pages read */
+	int     rc = SQLITE_DONE;						/* return code */
+	sqlite3_int64 lastdir = 0;						/* keyset: last row seen */
+	sqlite3_int64 lasttime = INT64_MIN;				/* keyset: last row seen */
 	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
-	struct stat stbuf;								/* file status */
-	time_t  curtime;								/* now */
+	struct expstate es = { 0 };						/* for expdecide */
 	unsigned long long db_size;						/* sql data */
-	uint32_t filecount;								/* matching files */
 	uint32_t removed = 0;							/* matching files removed */
-	unsigned long long dirbytes = 0L;				/* dirsize in bytes */
+	uint32_t rows;									/* rows in this page */
+	uint32_t walks;									/* scanwalks() at the first page */
+	uint64_t t;										/* query timing */
 
 	/* count all files */
 
-	if((filecount = count_files(ti, db)) < 1)
+	if((es.es_filecount = count_files(ti, db)) < 1)
 		return;
 
-	if(ti->ti_dirlimit) {							/* count bytes in dir */
-		if(snprintf(stmt, BUFSIZ, sql_selectbytes, ti->ti_task) >= BUFSIZ) {
-			fprintf(stderr, "%s: SQL statement truncated\n", ti->ti_section);
-			return;
-		}
+	if(ti->ti_dirlimit)								/* count bytes in dir */
+		es.es_dirbytes = dir_bytes(ti, db);
 
-		if(sqlite3_prepare_v2(db, stmt, -1, &pstmt, NULL) != SQLITE_OK) {
-			fprintf(stderr, "%s: sqlite3_prepare_v2: %s\n", ti->ti_section,
-					sqlite3_errmsg(db));
+	time(&es.es_curtime);
 
-			return;
-		}
-
-		if(sqlite3_step(pstmt) == SQLITE_ROW)
-			dirbytes = (unsigned long long)sqlite3_column_int64(pstmt, 0);
-		sqlite3_finalize(pstmt);
-	}
+	if(!exppending(ti, &es))						/* nothing old or over a limit */
+		return;
 
 	/* process expired files */
 
@@ -171,69 +179,51 @@ static void process_files(struct thread_info *ti, sqlite3 *db)
 		return;
 	}
 
-	time(&curtime);
+	walks = scanwalks(ti);
 
-	for(;;) {
-		if(ti->ti_retmin && filecount <= ti->ti_retmin)
-			break;
-
-		if(dryrun && drcount++ == 10) {				/* dryrun doesn't remove anything */
-			if(!ti->ti_terse)
-				fprintf(stderr, "%s: ...\n", ti->ti_section);
+	for(rows = QUERYLIM; !done && rows == QUERYLIM;) {
+		if(pages++) {								/* let the other sections in */
+			pthread_mutex_unlock(&dblock);
+			dblock_lock(ti);
+			sqlite3_reset(pstmt);
 
-			break;
+			if(scanwalks(ti) != walks)				/* a member walked, the keyset is stale */
+				break;
 		}
 
-		if(sqlite3_step(pstmt) != SQLITE_ROW)
-			break;
-
-		db_dir = (char *)sqlite3_column_text(pstmt, 0);
-		db_file = (char *)sqlite3_column_text(pstmt, 1);
-		db_size = (unsigned long long)sqlite3_column_int64(pstmt, 2);
-
-		/* assemble filename: ti_dirname + / + db_dir + / + db_file */
-
-		if(NOT_NULL(db_dir))
-			snprintf(filename, PATH_MAX, "%s/%s/%s", ti->ti_dirname, db_dir, db_file);
-		else
-			snprintf(filename, PATH_MAX, "%s/%s", ti->ti_dirname, db_file);
-
-		if(stat(filename, &stbuf) == -1)			/* check for changes since db load */
-			continue;
-
-		/*
-		 * if expiresiz is set, use it, else true
-		 * if expire is set, use it, else false
-		 */
-
-		expbysize = !ti->ti_expiresiz || stbuf.st_size > ti->ti_expiresiz;
-		expbytime = ti->ti_expire && stbuf.st_mtim.tv_sec + ti->ti_expire < curtime;
+		sqlite3_bind_int64(pstmt, 1, lasttime);
+		sqlite3_bind_int64(pstmt, 2, lastdir);
+		sqlite3_bind_text(pstmt, 3, lastfile, -1, SQLITE_STATIC);
 
-		/* files are sorted by time */
+		for(rows = 0; !done; rows++) {
+			if(dryrun && drcount++ == 10) {			/* dryrun doesn't remove anything */
+				if(!ti->ti_terse)
+					fprintf(stderr, "%s: ...\n", ti->ti_section);
 
-		if(ti->ti_retmax && filecount > ti->ti_retmax)
-			reason = "retmax";						/* too many */
+				done = true;
+				break;
+			}
 
-		else if(ti->ti_dirlimit && dirbytes > ti->ti_dirlimit)
-			reason = "dirlimit";					/* too much */
+			t = monotime();
+			rc = sqlite3_step(pstmt);
+			phase_add(ti, PH_QUERY, monotime() - t);
 
-		else if(expbysize && expbytime)
-			reason = "expire";						/* too old */
+			if(rc != SQLITE_ROW)
+				break;
 
-		else if(!expbytime)							/* done with the list */
-			break;
+			db_dir = (char *)sqlite3_column_text(pstmt, 0);
+			db_file = (char *)sqlite3_column_text(pstmt, 1);
+			db_size = (unsigned long long)sqlite3_column_int64(pstmt, 2);
+			lasttime = sqlite3_column_int64(pstmt, 3);
+			lastdir = sqlite3_column_int64(pstmt, 4);
+			strlcpy(lastfile, db_file ? db_file : "", PATH_MAX);
 
-		else										/* none of the above */
-			continue;
-
-		if(rmfile(ti, filename, reason)) {
-			removed++;
-			filecount--;
-			if(dirbytes >= db_size)
-				dirbytes -= db_size;
-			else
-				dirbytes = 0;
+			if(expone(ti, &es, db_dir, db_file, db_size, &removed) == false)
+				done = true;
 		}
+
+		if(rc != SQLITE_ROW && rc != SQLITE_DONE)
+			fprintf(stderr, "%s: sqlite3_step: %s\n", ti->ti_section, sqlite3_errmsg(db));
 	}
 
 	sqlite3_finalize(pstmt);
@@ -250,4 +240,43 @@ static void process_files(struct thread_info *ti, sqlite3 *db)
 				removed, removed == 1 ? "file" : "files");
 }
 
+static bool expone(struct thread_info *ti, struct expstate *es, char *db_dir,
+				   char *db_file, unsigned long long db_size, uint32_t *removed)
+{
+	/* one candidate, false when expdecide() says stop */
+
+	char    filename[PATH_MAX];						/* full pathname */
+	char   *reason;									/* why */
+	struct stat stbuf;								/* file status */
+
+	/* assemble filename: ti_dirname + / + db_dir + / + db_file */
+
+	if(NOT_NULL(db_dir))
+		snprintf(filename, PATH_MAX, "%s/%s/%s", ti->ti_dirname, db_dir, db_file);
+	else
+		snprintf(filename, PATH_MAX, "%s/%s", ti->ti_dirname, db_file);
+
+	if(stat(filename, &stbuf) == -1)				/* check for changes since db load */
+		return (true);
+
+	switch (expdecide(ti, es, stbuf.st_size, stbuf.st_mtim.tv_sec, &reason)) {
+
+	case EXP_STOP:									/* done with the list */
+		return (false);
+
+	case EXP_KEEP:
+		break;
+
+	case EXP_REMOVE:
+		if(rmfile(ti, filename, reason)) {
+			(*removed)++;
+			expremoved(ti, es, db_size);
+		}
+
+		break;
+	}
+
+	return (true);
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -0,0 +1,514 @@
+/*
+ * fifobench.c
+ * Benchmark FIFO ingestion: producers -> FIFO -> sentinal -> command -> logfile.
+ * Writes a one-section INI file to a scratch directory, runs sentinal on
+ * it, and forks producers that write numbered records into the FIFO.
+ * Small rotatesiz values force rotations while the producers write.
+ *
+ * Reports MB/s from the first write until the logfiles stop growing,
+ * producer write() latency percentiles (time blocked on a full FIFO),
+ * and, by reading the logfiles back, records lost, duplicated or
+ * damaged across rotations.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <grp.h>
+#include <inttypes.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sentinal.h"
+#include "basename.h"
+
+#define	MINREC		24								/* "ppp sssssssssss " + a few */
+#define	SETTLE		2000000							/* usec without growth: done */
+#define	STARTWAIT	10000000						/* usec for sentinal's FIFO */
+
+static bool lines = false;							/* variable length records */
+static char *command = "/bin/cat";					/* INI command */
+static char *sentinal = "./sentinal";				/* binary under test */
+static char *template = "bench-%s.log";				/* INI template */
+static char *rotatesiz = "1M";						/* INI rotatesiz */
+static char *uncompress;							/* read logfiles through this */
+static int nprod = 4;								/* producers */
+static int nrecs = 100000;							/* records per producer */
+static int recsize = 128;							/* record size, max for --lines */
+
+static struct option long_options[] = {
+	{ "producers", required_argument, NULL, 'p' },
+	{ "records", required_argument, NULL, 'n' },
+	{ "size", required_argument, NULL, 'b' },
+	{ "lines", no_argument, NULL, 'l' },
+	{ "rotatesiz", required_argument, NULL, 'R' },
+	{ "template", required_argument, NULL, 't' },
+	{ "command", required_argument, NULL, 'c' },
+	{ "uncompress", required_argument, NULL, 'u' },
+	{ "sentinal", required_argument, NULL, 's' },
+	{ "keep", no_argument, NULL, 'k' },
+	{ "help", no_argument, NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+static int cmpu32(const void *, const void *);
+static int rmentry(const char *, const struct stat *, int, struct FTW *);
+static int rotations(char *);
+static int reclen(int, uint32_t);
+static off_t logbytes(char *);
+static uint64_t benchtime(void);
+static void help(char *);
+static void producer(char *, int, uint32_t *);
+static void verify(char *, uint8_t *, uint64_t *);
+
+int main(int argc, char *argv[])
+{
+	bool    keep = false;							/* leave the scratch directory */
+	char    dir[PATH_MAX] = "/tmp/fifobench.XXXXXX";	/* scratch directory */
+	char    fifo[PATH_MAX];
+	char    inifile[PATH_MAX];
+	char    path[PATH_MAX];
+	char   *myname;
+	FILE   *fp;
+	int     c;
+	int     fd;
+	int     i;
+	int     index = 0;
+	off_t   last = -1;								/* logfile bytes */
+	off_t   now;
+	pid_t   spid;									/* sentinal */
+	size_t  nlat;
+	struct stat stbuf;
+	uint8_t *seen;									/* per record, times found */
+	uint32_t *lat;									/* write() usec, shared */
+	uint64_t bad[4] = { 0 };						/* lost, dup, damaged records, files */
+	uint64_t blocked = 0;							/* total write() time */
+	uint64_t expect = 0;							/* bytes written */
+	uint64_t grown;									/* last growth */
+	uint64_t lost = 0;								/* bytes */
+	uint64_t dup = 0;								/* bytes */
+	uint64_t slow = 0;								/* writes over 10ms */
+	uint64_t t0;
+
+	myname = base(argv[0]);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	while((c = getopt_long(argc, argv, "p:n:b:lR:t:c:u:s:kh?", long_options, &index)) != -1)
+		switch (c) {
+
+		case 'p':
+			nprod = atoi(optarg);
+			break;
+
+		case 'n':
+			nrecs = atoi(optarg);
+			break;
+
+		case 'b':
+			recsize = atoi(optarg);
+			break;
+
+		case 'l':
+			lines = true;
+			break;
+
+		case 'R':
+			rotatesiz = optarg;
+			break;
+
+		case 't':
+			template = optarg;
+			break;
+
+		case 'c':
+			command = optarg;
+			break;
+
+		case 'u':
+			uncompress = optarg;
+			break;
+
+		case 's':
+			sentinal = optarg;
+			break;
+
+		case 'k':
+			keep = true;
+			break;
+
+		case 'h':
+		case '?':
+		default:
+			help(myname);
+			exit(EXIT_SUCCESS);
+		}
+
+	/* records are written whole, PIPE_BUF keeps producers from interleaving */
+
+	if(nprod < 1 || nprod > 999 || nrecs < 1 || recsize < MINREC || recsize > PIPE_BUF) {
+		help(myname);
+		exit(EXIT_FAILURE);
+	}
+
+	if(realpath(sentinal, path) == NULL || access(path, X_OK) == -1) {
+		fprintf(stderr, "%s: can't run %s\n", myname, sentinal);
+		exit(EXIT_FAILURE);
+	}
+
+	if(mkdtemp(dir) == NULL) {
+		fprintf(stderr, "%s: can't create %s\n", myname, dir);
+		exit(EXIT_FAILURE);
+	}
+
+	/* one wrk section */
+
+	snprintf(inifile, PATH_MAX, "%s/bench.ini", dir);
+	snprintf(fifo, PATH_MAX, "%s/bench.fifo", dir);
+
+	if((fd = open(inifile, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1 ||
+	   (fp = fdopen(fd, "w")) == NULL) {
+		fprintf(stderr, "%s: can't create %s\n", myname, inifile);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(fp, "[global]\npidfile = %s/bench.pid\n\n", dir);
+	fprintf(fp, "[bench]\ndirname = %s\npipename = bench.fifo\n", dir);
+	fprintf(fp, "template = %s\ncommand = %s\nrotatesiz = %s\n", template, command, rotatesiz);
+	fprintf(fp, "uid = %s\ngid = %s\n", getpwuid(getuid())->pw_name, getgrgid(getgid())->gr_name);
+	fclose(fp);
+
+	switch (spid = fork()) {
+
+	case -1:
+		fprintf(stderr, "%s: can't fork\n", myname);
+		exit(EXIT_FAILURE);
+
+	case 0:
+		snprintf(dir + strlen(dir), PATH_MAX - strlen(dir), "/sentinal.err");
+
+		if((fd = open(dir, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+			dup2(fd, STDERR_FILENO);
+
+		execl(path, "sentinal", "-f", inifile, (char *)NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	for(t0 = benchtime(); stat(fifo, &stbuf) == -1; usleep(10000))
+		if(benchtime() - t0 > STARTWAIT || waitpid(spid, NULL, WNOHANG) == spid) {
+			fprintf(stderr, "%s: sentinal did not create %s, see %s/sentinal.err\n",
+					myname, fifo, dir);
+			kill(spid, SIGTERM);
+			exit(EXIT_FAILURE);
+		}
+
+	fprintf(stdout, "%s: %d producers x %d %s records of %s%d bytes, rotatesiz %s\n",
+			dir, nprod, nrecs, lines ? "line" : "fixed", lines ? "up to " : "", recsize,
+			rotatesiz);
+	fprintf(stdout, "command: %s, template: %s\n", command, template);
+
+	/* producers, write latencies come back through shared memory */
+
+	nlat = (size_t)nprod * nrecs;
+
+	if((lat = mmap(NULL, nlat * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ||
+	   (seen = calloc(nlat, 1)) == NULL) {
+		fprintf(stderr, "%s: out of memory\n", myname);
+		kill(spid, SIGTERM);
+		exit(EXIT_FAILURE);
+	}
+
+	t0 = benchtime();
+
+	for(i = 0; i < nprod; i++)
+		if(fork() == 0) {
+			producer(fifo, i, lat + (size_t)i * nrecs);
+			_exit(EXIT_SUCCESS);
+		}
+
+	for(i = 0; i < nprod; i++)
+		wait(NULL);
+
+	/* sentinal is done when the logfiles stop growing */
+
+	for(i = 0; i < nprod; i++)
+		for(c = 0; c < nrecs; c++)
+			expect += reclen(i, c);
+
+	for(grown = benchtime(); benchtime() - grown < SETTLE; usleep(10000)) {
+		if((now = logbytes(dir)) != last) {
+			last = now;
+			grown = benchtime();
+		}
+
+		if(!uncompress && (uint64_t)now >= expect)
+			break;
+	}
+
+	kill(spid, SIGTERM);
+	waitpid(spid, NULL, 0);
+	usleep(100000);									/* let the command flush */
+
+	/* report */
+
+	for(i = 0; (size_t)i < nlat; i++) {
+		blocked += lat[i];
+		slow += lat[i] > 10000;
+	}
+
+	qsort(lat, nlat, sizeof(uint32_t), cmpu32);
+
+	fprintf(stdout, "throughput: %.1f MB/s, %.0f records/s, %" PRIu64 " bytes in %.3fs\n",
+			expect / ((grown - t0) / 1e6) / 1e6, nlat / ((grown - t0) / 1e6),
+			expect, (grown - t0) / 1e6);
+	fprintf(stdout, "write latency: p50 %uus p99 %uus p99.9 %uus max %uus\n",
+			lat[nlat / 2], lat[nlat * 99 / 100], lat[nlat * 999 / 1000], lat[nlat - 1]);
+	fprintf(stdout, "producers blocked: %.3fs total, %" PRIu64 " writes over 10ms\n",
+			blocked / 1e6, slow);
+
+	verify(dir, seen, bad);
+
+	for(i = 0; i < nprod; i++)
+		for(c = 0; c < nrecs; c++) {
+			if(seen[(size_t)i * nrecs + c] == 0)
+				lost += reclen(i, c);
+			else if(seen[(size_t)i * nrecs + c] > 1)
+				dup += reclen(i, c) * (seen[(size_t)i * nrecs + c] - 1);
+		}
+
+	fprintf(stdout, "logfiles: %" PRIu64 ", rotations: %d\n", bad[3], rotations(dir));
+	fprintf(stdout, "lost: %" PRIu64 " records %" PRIu64 " bytes, duplicated: %" PRIu64
+			" records %" PRIu64 " bytes, damaged: %" PRIu64 " lines\n",
+			bad[0], lost, bad[1], dup, bad[2]);
+
+	if(!keep && nftw(dir, rmentry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+		fprintf(stderr, "%s: can't remove %s\n", myname, dir);
+
+	exit(bad[0] || bad[1] || bad[2] ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static uint64_t benchtime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+static int reclen(int prod, uint32_t seq)
+{
+	/* fixed, or a length that verify() can recompute */
+
+	uint32_t h = (uint32_t)prod * 2654435761u ^ seq * 2246822519u;
+
+	if(!lines)
+		return (recsize);
+
+	h ^= h >> 15;
+	return (MINREC + (int)(h % (uint32_t)(recsize - MINREC + 1)));
+}
+
+static void producer(char *fifo, int prod, uint32_t *lat)
+{
+	/* "ppp sssssssssss xxx...\n", one write() per record */
+
+	char    rec[PIPE_BUF];
+	int     fd;
+	int     len;
+	int     n;
+	uint32_t seq;
+	uint64_t t;
+
+	if((fd = open(fifo, O_WRONLY)) == -1) {
+		fprintf(stderr, "producer %d: can't open %s: %s\n", prod, fifo, strerror(errno));
+		return;
+	}
+
+	for(seq = 0; seq < (uint32_t)nrecs; seq++) {
+		len = reclen(prod, seq);
+		n = snprintf(rec, sizeof(rec), "%03d %010u ", prod, seq);
+		memset(rec + n, 'x', len - n - 1);
+		rec[len - 1] = '\n';
+
+		t = benchtime();
+
+		if(write(fd, rec, len) != len) {
+			fprintf(stderr, "producer %d: write failed: %s\n", prod, strerror(errno));
+			break;
+		}
+
+		lat[seq] = (uint32_t)(benchtime() - t);
+	}
+
+	close(fd);
+}
+
+static off_t logbytes(char *dir)
+{
+	/* total size of the logfiles, anything not ours */
+
+	char    path[PATH_MAX];
+	DIR    *dirp;
+	off_t   total = 0;
+	struct dirent *dp;
+	struct stat stbuf;
+
+	if((dirp = opendir(dir)) == NULL)
+		return (0);
+
+	while((dp = readdir(dirp)) != NULL) {
+		if(*dp->d_name == '.' || strncmp(dp->d_name, "bench.", 6) == 0 ||
+		   strcmp(dp->d_name, "sentinal.err") == 0)
+			continue;
+
+		snprintf(path, PATH_MAX, "%s/%s", dir, dp->d_name);
+
+		if(stat(path, &stbuf) == 0 && S_ISREG(stbuf.st_mode))
+			total += stbuf.st_size;
+	}
+
+	closedir(dirp);
+	return (total);
+}
+
+static void verify(char *dir, uint8_t *seen, uint64_t *bad)
+{
+	/* read every logfile back, count each record found */
+
+	char    cmd[PATH_MAX * 2];
+	char    path[PATH_MAX];
+	char   *line = NULL;
+	DIR    *dirp;
+	FILE   *fp;
+	int     prod;
+	size_t  len = 0;
+	ssize_t n;
+	struct dirent *dp;
+	uint32_t seq;
+	uint64_t dupes = 0;
+	uint64_t found = 0;
+
+	if((dirp = opendir(dir)) == NULL)
+		return;
+
+	while((dp = readdir(dirp)) != NULL) {
+		if(*dp->d_name == '.' || strncmp(dp->d_name, "bench.", 6) == 0 ||
+		   strcmp(dp->d_name, "sentinal.err") == 0)
+			continue;
+
+		snprintf(path, PATH_MAX, "%s/%s", dir, dp->d_name);
+
+		if(uncompress) {
+			snprintf(cmd, sizeof(cmd), "%s '%s'", uncompress, path);
+			fp = popen(cmd, "r");
+		} else
+			fp = fopen(path, "r");
+
+		if(fp == NULL)
+			continue;
+
+		bad[3]++;
+
+		while((n = getline(&line, &len, fp)) > 0) {
+			if(sscanf(line, "%3d %10u ", &prod, &seq) != 2 || prod < 0 || prod >= nprod ||
+			   seq >= (uint32_t)nrecs || n != reclen(prod, seq) || line[n - 1] != '\n') {
+				bad[2]++;
+				continue;
+			}
+
+			if(seen[(size_t)prod * nrecs + seq]++ == 0)
+				found++;
+			else
+				dupes++;
+
+			if(seen[(size_t)prod * nrecs + seq] == UINT8_MAX)
+				seen[(size_t)prod * nrecs + seq]--;	/* saturate */
+		}
+
+		if(uncompress)
+			pclose(fp);
+		else
+			fclose(fp);
+	}
+
+	closedir(dirp);
+	free(line);
+
+	bad[0] = (uint64_t)nprod * nrecs - found;
+	bad[1] = dupes;
+}
+
+static int rotations(char *dir)
+{
+	/* sentinal logs each one, several may reuse a logfile name */
+
+	char    buf[BUFSIZ];
+	char    path[PATH_MAX];
+	FILE   *fp;
+	int     n = 0;
+
+	snprintf(path, PATH_MAX, "%s/sentinal.err", dir);
+
+	if((fp = fopen(path, "r")) == NULL)
+		return (0);
+
+	while(fgets(buf, BUFSIZ, fp))
+		if(strstr(buf, ": rotate "))
+			n++;
+
+	fclose(fp);
+	return (n);
+}
+
+static int cmpu32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static int rmentry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+
+	return (remove(path));
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, " -p, --producers N    processes writing to the FIFO (4)\n");
+	fprintf(stderr, " -n, --records N      records per producer (100000)\n");
+	fprintf(stderr, " -b, --size N         record size, %d to %d bytes (128)\n", MINREC, PIPE_BUF);
+	fprintf(stderr, " -l, --lines          variable length lines up to --size\n");
+	fprintf(stderr, " -R, --rotatesiz S    INI rotatesiz (1M)\n");
+	fprintf(stderr, " -t, --template T     INI template (bench-%%s.log)\n");
+	fprintf(stderr, " -c, --command C      INI command (/bin/cat)\n");
+	fprintf(stderr, " -u, --uncompress C   read logfiles with C, e.g. \"zstd -dcq\"\n");
+	fprintf(stderr, " -s, --sentinal PATH  sentinal binary (./sentinal)\n");
+	fprintf(stderr, " -k, --keep           keep the scratch directory\n");
+	fprintf(stderr, " -h, --help           this message\n");
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -16,34 +16,94 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <sqlite3.h>
 #include <string.h>
 #include <errno.h>
 #include "sentinal.h"
 
 #define INSERT_DIR_SQL	"INSERT INTO \"%s_dir\" VALUES(?, ?, ?);"
-#define INSERT_FILE_SQL	"INSERT INTO \"%s_file\" VALUES(?, ?, ?, ?);"
+#define INSERT_FILE_SQL	"INSERT INTO \"%s_file\" VALUES"
 #define UPDATE_DIR_SQL	"UPDATE \"%s_dir\" SET db_empty = 1 WHERE db_id = ?;"
+#define BULKROWS		200							/* rows per INSERT, 4 binds each */
+
+/*
+ * _file rows wait in an arena and go in BULKROWS at a time, one
+ * multi-row INSERT instead of a bind/step/reset per file
+ * the statements are prepared once per walk, not per directory
+ */
+
+struct bulkrow {
+	uint32_t br_dirid;								/* db_dirid */
+	uint32_t br_name;								/* db_file, offset in bl_names */
+	time_t  br_time;								/* db_time */
+	off_t   br_size;								/* db_size */
+};
+
+struct bulkload {
+	struct thread_info *bl_ti;						/* whose tables */
+	sqlite3_stmt *bl_insert;						/* BULKROWS rows */
+	sqlite3_stmt *bl_dir;							/* insert_dir */
+	sqlite3_stmt *bl_empty;							/* update_dir */
+	int     bl_nrows;								/* rows waiting */
+	size_t  bl_used;								/* bytes of bl_names used */
+	struct bulkrow bl_rows[BULKROWS];
+	char    bl_names[BULKROWS * (NAME_MAX + 1)];	/* always room for a full batch */
+};
+
+static bool bulkflush(struct thread_info *, struct bulkload *, sqlite3 *);
+static bool bulkopen(struct bulkload *, sqlite3 *);
+static sqlite3_stmt *bulkstmt(struct thread_info *, sqlite3 *, int);
+static void bulkclose(struct thread_info *, int, sqlite3 *);
+
+static struct bulkload *bulk;						/* [nti] for the walk, dblock held */
 
 uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 				  char *dir, sqlite3 *db)
 {
 	DIR    *dirp;
+	bool    keepall;								/* regexp sharedscan, views match */
+	int     i;
+	int     nti = 1;								/* sections whose tables we fill */
 	char    fullpath[PATH_MAX];						/* full pathname */
 	char    relpath[PATH_MAX];						/* relative pathname */
-	char    stmtbuf[BUFSIZ];						/* statement buffer */
-	sqlite3_stmt *insert_dir_stmt = NULL;
-	sqlite3_stmt *insert_file_stmt = NULL;
-	sqlite3_stmt *update_dir_stmt = NULL;
+	size_t  len;									/* d_name, with its NUL */
+	struct bulkload *bl;							/* bulk[i] */
+	struct bulkrow *br;								/* next row in its arena */
 	struct dirent *dp;
+	struct phaseclock pc;							/* walk and index timing */
 	struct stat st;									/* file status */
+	struct thread_info **tis = &ti;					/* ti, or its fanout group */
 	uint32_t entries = 0;							/* file entries */
 	uint32_t rowid = *nextid;						/* db_id, db_dirid */
+	uint32_t seen = 0;								/* for metrics */
+	uint64_t start = top ? monotime() : 0;			/* scan time */
+	uint64_t t;										/* per-call timing */
+
+	if(top && scanfresh(ti))						/* another section just walked it */
+		return (ti->ti_scangroup->sg_entries);
+
+	if(ti->ti_scangroup && ti->ti_scangroup->sg_fanout) {
+		tis = ti->ti_scangroup->sg_ti;
+		nti = ti->ti_scangroup->sg_members;
+	}
+
+	keepall = ti->ti_scangroup && !ti->ti_scangroup->sg_fanout;
+
+	if(top)											/* ends paged passes over the old tables */
+		scanbegin(ti);
+
+	for(i = 0; top && i < nti; i++)					/* valid again after COMMIT */
+		memset(&tis[i]->ti_stats, '\0', sizeof(struct tablestats));
 
 	if((dirp = opendir(dir)) == NULL)
 		return (0);
 
+	if(top)
+		phase_start(&pc);
+
 	if(top) {
 		if(stat(dir, &st) == -1) {
 			fprintf(stderr, "%s: cannot stat: %s: %s\n", ti->ti_section, dir,
@@ -53,8 +113,13 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 			return (0);
 		}
 
-		if(!drop_table(ti, db) || !create_table(ti, db) ||
-		   !journal_mode(ti, db) || !sync_commit(ti, db)) {
+		for(i = 0; i < nti; i++)
+			if(!drop_table(tis[i], db) || !create_table(tis[i], db)) {
+				closedir(dirp);
+				return (0);
+			}
+
+		if(!journal_mode(ti, db) || !sync_commit(ti, db)) {
 			closedir(dirp);
 			return (0);
 		}
@@ -62,21 +127,29 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 		ti->ti_dev = st.st_dev;						/* save mountpoint device */
 		rowid = *nextid = 1;						/* starting over */
 
-		if(sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
-			fprintf(stderr, "%s: sqlite3_exec BEGIN failed: %s\n",
-					ti->ti_section, sqlite3_errmsg(db));
+		if((bulk = calloc(nti, sizeof(struct bulkload))) == NULL) {
+			fprintf(stderr, "%s: calloc failed\n", ti->ti_section);
 			closedir(dirp);
 			return (0);
 		}
-	}
 
-	snprintf(stmtbuf, sizeof(stmtbuf), INSERT_DIR_SQL, ti->ti_task);
+		for(i = 0; i < nti; i++) {
+			bulk[i].bl_ti = tis[i];
 
-	if(sqlite3_prepare_v2(db, stmtbuf, -1, &insert_dir_stmt, NULL) != SQLITE_OK) {
-		fprintf(stderr, "%s: sqlite3_prepare_v2 insert_dir: %s\n",
-				ti->ti_section, sqlite3_errmsg(db));
+			if(!bulkopen(&bulk[i], db)) {
+				bulkclose(ti, nti, db);
+				closedir(dirp);
+				return (0);
+			}
+		}
 
-		goto cleanup;
+		if(sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL) != SQLITE_OK) {
+			fprintf(stderr, "%s: sqlite3_exec BEGIN failed: %s\n",
+					ti->ti_section, sqlite3_errmsg(db));
+			bulkclose(ti, nti, db);
+			closedir(dirp);
+			return (0);
+		}
 	}
 
 	if(top) {
@@ -86,31 +159,27 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 		snprintf(relpath, sizeof(relpath), "%s", dir + prefix_len + 1);
 	}
 
-	sqlite3_bind_int(insert_dir_stmt, 1, rowid);
-	sqlite3_bind_text(insert_dir_stmt, 2, relpath, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_int(insert_dir_stmt, 3, 0);
-	if(sqlite3_step(insert_dir_stmt) != SQLITE_DONE) {
-		fprintf(stderr, "%s: sqlite3_step insert_dir failed: %s\n",
-				ti->ti_section, sqlite3_errmsg(db));
-		sqlite3_finalize(insert_dir_stmt);
-		goto cleanup;
+	for(i = 0; i < nti; i++) {
+		bl = &bulk[i];
+		sqlite3_reset(bl->bl_dir);
+		sqlite3_bind_int(bl->bl_dir, 1, rowid);
+		sqlite3_bind_text(bl->bl_dir, 2, relpath, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int(bl->bl_dir, 3, 0);
+		if(sqlite3_step(bl->bl_dir) != SQLITE_DONE) {
+			fprintf(stderr, "%s: sqlite3_step insert_dir failed: %s\n",
+					tis[i]->ti_section, sqlite3_errmsg(db));
+			goto cleanup;
+		}
 	}
-	sqlite3_finalize(insert_dir_stmt);
-	insert_dir_stmt = NULL;
 
-	snprintf(stmtbuf, sizeof(stmtbuf), INSERT_FILE_SQL, ti->ti_task);
+	for(t = monotime(); (dp = readdir(dirp)) != NULL; t = monotime()) {
+		phase_add(ti, PH_READDIR, monotime() - t);
 
-	if(sqlite3_prepare_v2(db, stmtbuf, -1, &insert_file_stmt, NULL) != SQLITE_OK) {
-		fprintf(stderr, "%s: sqlite3_prepare_v2 insert_file: %s\n",
-				ti->ti_section, sqlite3_errmsg(db));
-
-		goto cleanup;
-	}
-
-	while((dp = readdir(dirp)) != NULL) {
 		if(MY_DIR(dp->d_name) || MY_PARENT(dp->d_name))
 			continue;
 
+		seen++;
+
 		if(snprintf(fullpath, sizeof(fullpath),
 					"%s/%s", dir, dp->d_name) >= sizeof(fullpath)) {
 			fprintf(stderr, "%s: path too long: %s/%s\n", ti->ti_section, dir,
@@ -119,9 +188,13 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 			continue;
 		}
 
+		t = monotime();
+
 		if(lstat(fullpath, &st) == -1)
 			continue;
 
+		phase_add(ti, PH_STAT, monotime() - t);
+
 		if(S_ISLNK(st.st_mode)) {
 			if(!ti->ti_symlinks) {					/* count this entry */
 				entries++;
@@ -149,25 +222,35 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 
 		entries++;
 
-		if(!S_ISREG(st.st_mode) || !namematch(ti, dp->d_name))
+		if(!S_ISREG(st.st_mode))
 			continue;
 
-		sqlite3_reset(insert_file_stmt);
-		sqlite3_bind_int(insert_file_stmt, 1, rowid);
-		sqlite3_bind_text(insert_file_stmt, 2, dp->d_name, -1, SQLITE_TRANSIENT);
-		sqlite3_bind_int(insert_file_stmt, 3, (int)st.st_mtim.tv_sec);
-		sqlite3_bind_int64(insert_file_stmt, 4, (sqlite3_int64) st.st_size);
-		if(sqlite3_step(insert_file_stmt) != SQLITE_DONE) {
-			fprintf(stderr, "%s: sqlite3_step insert_file failed: %s\n",
-					ti->ti_section, sqlite3_errmsg(db));
-			// Continue to next entry
+		/*
+		 * regexp sharedscan keeps every file, the section views match names
+		 * fanout sharedscan matches for each section in the group
+		 */
+
+		len = strlen(dp->d_name) + 1;				/* <= NAME_MAX + 1 */
+
+		for(i = 0; i < nti; i++) {
+			if(!keepall && !namematch(tis[i], dp->d_name))
+				continue;
+
+			bl = &bulk[i];
+			br = &bl->bl_rows[bl->bl_nrows++];
+			br->br_dirid = rowid;
+			br->br_name = bl->bl_used;
+			br->br_time = st.st_mtim.tv_sec;
+			br->br_size = st.st_size;
+			memcpy(bl->bl_names + bl->bl_used, dp->d_name, len);
+			bl->bl_used += len;
+
+			if(bl->bl_nrows == BULKROWS)
+				bulkflush(ti, bl, db);
 		}
 	}
 
   cleanup:
-	if(insert_file_stmt)
-		sqlite3_finalize(insert_file_stmt);
-
 	closedir(dirp);
 
 	/*
@@ -175,31 +258,171 @@ uint32_t findfile(struct thread_info *ti, bool top, uint32_t *nextid,
 	 * we are interested only in empty directories
 	 */
 
-	if(entries == 0) {
-		snprintf(stmtbuf, sizeof(stmtbuf), UPDATE_DIR_SQL, ti->ti_task);
-
-		if(sqlite3_prepare_v2(db, stmtbuf, -1, &update_dir_stmt, NULL) == SQLITE_OK) {
-			sqlite3_bind_int(update_dir_stmt, 1, rowid);
-			if(sqlite3_step(update_dir_stmt) != SQLITE_DONE) {
-				fprintf(stderr, "%s: sqlite3_step update_dir failed: %s\n",
-						ti->ti_section, sqlite3_errmsg(db));
-			}
-			sqlite3_finalize(update_dir_stmt);
-		} else {
-			fprintf(stderr, "%s: sqlite3_prepare_v2 update_dir: %s\n",
-					ti->ti_section, sqlite3_errmsg(db));
-		}
+	for(i = 0; entries == 0 && i < nti; i++) {
+		bl = &bulk[i];
+		sqlite3_reset(bl->bl_empty);
+		sqlite3_bind_int(bl->bl_empty, 1, rowid);
+		if(sqlite3_step(bl->bl_empty) != SQLITE_DONE) {
+			fprintf(stderr, "%s: sqlite3_step update_dir failed: %s\n",
+					tis[i]->ti_section, sqlite3_errmsg(db));
+		} else
+			tis[i]->ti_stats.ts_emptydirs++;
 	}
 
-	if(top) {										/* indexes */
-		create_index(ti, db);
+	if(top) {										/* the last rows, then indexes */
+		bulkclose(ti, nti, db);
+		phase_stop(ti, PH_WALK, &pc);
+		phase_start(&pc);
+
+		for(i = 0; i < nti; i++)
+			create_index(tis[i], db);
+
 		if(sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
 			fprintf(stderr, "%s: sqlite3_exec COMMIT failed: %s\n",
 					ti->ti_section, sqlite3_errmsg(db));
+		} else {
+			for(i = 0; !keepall && i < nti; i++)	/* regexp sharedscan counts in SQL */
+				tis[i]->ti_stats.ts_valid = true;
 		}
+
+		phase_stop(ti, PH_INDEX, &pc);
+		scandone(ti, entries);
+		METRIC_ADD(ti, mt_scans, 1);
+		METRIC_ADD(ti, mt_scanusec, monotime() - start);
+		METRIC_SET(ti, mt_lastscan, monotime() - start);
 	}
 
+	METRIC_ADD(ti, mt_seen, seen);
 	return (entries);
 }
 
+static bool bulkopen(struct bulkload *bl, sqlite3 *db)
+{
+	/* the walk's statements for one section's tables */
+
+	char    stmtbuf[BUFSIZ];						/* statement buffer */
+
+	if((bl->bl_insert = bulkstmt(bl->bl_ti, db, BULKROWS)) == NULL)
+		return (false);
+
+	snprintf(stmtbuf, sizeof(stmtbuf), INSERT_DIR_SQL, scantable(bl->bl_ti));
+
+	if(sqlite3_prepare_v2(db, stmtbuf, -1, &bl->bl_dir, NULL) != SQLITE_OK) {
+		fprintf(stderr, "%s: sqlite3_prepare_v2 insert_dir: %s\n",
+				bl->bl_ti->ti_section, sqlite3_errmsg(db));
+
+		return (false);
+	}
+
+	snprintf(stmtbuf, sizeof(stmtbuf), UPDATE_DIR_SQL, scantable(bl->bl_ti));
+
+	if(sqlite3_prepare_v2(db, stmtbuf, -1, &bl->bl_empty, NULL) != SQLITE_OK) {
+		fprintf(stderr, "%s: sqlite3_prepare_v2 update_dir: %s\n",
+				bl->bl_ti->ti_section, sqlite3_errmsg(db));
+
+		return (false);
+	}
+
+	return (true);
+}
+
+static sqlite3_stmt *bulkstmt(struct thread_info *ti, sqlite3 *db, int nrows)
+{
+	/* INSERT INTO "task_file" VALUES(?, ?, ?, ?), ... nrows times */
+
+	char   *sql;
+	int     r;
+	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
+	sqlite3_str *str = sqlite3_str_new(db);
+
+	sqlite3_str_appendf(str, INSERT_FILE_SQL, scantable(ti));
+
+	for(r = 0; r < nrows; r++)
+		sqlite3_str_appendall(str, r ? ", (?, ?, ?, ?)" : "(?, ?, ?, ?)");
+
+	sqlite3_str_appendchar(str, 1, ';');
+
+	if((sql = sqlite3_str_finish(str)) == NULL ||
+	   sqlite3_prepare_v2(db, sql, -1, &pstmt, NULL) != SQLITE_OK)
+		fprintf(stderr, "%s: sqlite3_prepare_v2 insert_file: %s\n",
+				ti->ti_section, sqlite3_errmsg(db));
+
+	sqlite3_free(sql);
+	return (pstmt);
+}
+
+static bool bulkflush(struct thread_info *ti, struct bulkload *bl, sqlite3 *db)
+{
+	/* the arena in one INSERT, a short tail gets a statement of its own */
+
+	bool    ok;
+	int     r;
+	int     rc;										/* sqlite return code */
+	sqlite3_stmt *pstmt = bl->bl_insert;			/* prepared statement */
+	struct bulkrow *br;								/* arena row */
+	struct tablestats *ts = &bl->bl_ti->ti_stats;	/* shorthand */
+	uint64_t t;										/* insert timing */
+
+	if(bl->bl_nrows == 0)
+		return (true);
+
+	if(bl->bl_nrows < BULKROWS)
+		pstmt = bulkstmt(bl->bl_ti, db, bl->bl_nrows);
+
+	t = monotime();									/* binds and step */
+
+	for(r = 0; pstmt && r < bl->bl_nrows; r++) {
+		br = &bl->bl_rows[r];
+		sqlite3_bind_int(pstmt, 4 * r + 1, br->br_dirid);
+		sqlite3_bind_text(pstmt, 4 * r + 2, bl->bl_names + br->br_name, -1, SQLITE_STATIC);
+		sqlite3_bind_int(pstmt, 4 * r + 3, (int)br->br_time);
+		sqlite3_bind_int64(pstmt, 4 * r + 4, (sqlite3_int64) br->br_size);
+	}
+
+	rc = pstmt ? sqlite3_step(pstmt) : SQLITE_ERROR;
+	phase_add(ti, PH_INSERT, monotime() - t);
+
+	if((ok = rc == SQLITE_DONE)) {
+		for(r = 0; r < bl->bl_nrows; r++) {
+			br = &bl->bl_rows[r];
+			ts->ts_bytes += (unsigned long long)br->br_size;
+
+			if(ts->ts_files++ == 0 || br->br_time < ts->ts_oldest)
+				ts->ts_oldest = br->br_time;
+		}
+
+		if(bl->bl_ti->ti_scangroup == NULL || bl->bl_ti->ti_scangroup->sg_fanout)
+			METRIC_ADD(bl->bl_ti, mt_matched, bl->bl_nrows);	/* regexp sharedscan matches in SQL */
+	} else if(pstmt) {
+		fprintf(stderr, "%s: sqlite3_step insert_file failed: %s\n",
+				bl->bl_ti->ti_section, sqlite3_errmsg(db));
+	}
+
+	if(pstmt == bl->bl_insert)
+		sqlite3_reset(pstmt);
+	else
+		sqlite3_finalize(pstmt);
+
+	bl->bl_nrows = 0;
+	bl->bl_used = 0;
+	return (ok);
+}
+
+static void bulkclose(struct thread_info *ti, int nti, sqlite3 *db)
+{
+	/* flush what is left, then drop the walk's statements and arena */
+
+	int     i;
+
+	for(i = 0; i < nti; i++) {
+		bulkflush(ti, &bulk[i], db);
+		sqlite3_finalize(bulk[i].bl_insert);
+		sqlite3_finalize(bulk[i].bl_dir);
+		sqlite3_finalize(bulk[i].bl_empty);
+	}
+
+	free(bulk);
+	bulk = NULL;
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
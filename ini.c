@@ -21,6 +21,9 @@
  *
  * Wed Sep 20 02:39:25 PM PDT 2023
  * remove unused ini_sget()
+ *
+ * Mon Oct 19 09:12:40 AM PDT 2026
+ * index (section, key) lookups and section names at load
  */
 
 #include <stdio.h>
@@ -176,6 +179,102 @@ static void split_data(ini_t *ini)
 	}
 }
 
+/* Case insensitive FNV-1a of section and key */
+static size_t hash_ci(const char *section, const char *key)
+{
+	size_t  h = 2166136261u;
+
+	while(*section) {
+		h = (h ^ (unsigned char)tolower((unsigned char)*section++)) * 16777619u;
+	}
+	h = (h ^ '[') * 16777619u;
+	while(*key) {
+		h = (h ^ (unsigned char)tolower((unsigned char)*key++)) * 16777619u;
+	}
+	return h;
+}
+
+static struct ini_entry *find_entry(const ini_t *ini, const char *section, const char *key)
+{
+	size_t  mask = ini->index_size - 1;
+	size_t  h = hash_ci(section, key) & mask;
+
+	while(ini->index[h].key) {
+		if(!strcmpci(ini->index[h].key, key) && !strcmpci(ini->index[h].section, section)) {
+			break;
+		}
+		h = (h + 1) & mask;
+	}
+	return &ini->index[h];
+}
+
+/* Walks the split data once, as ini_get() does, to index every
+ * (section, key) pair and list the section names. The first
+ * occurrence of a pair wins, matching the linear search. */
+static int build_index(ini_t *ini)
+{
+	char   *current_section = "";
+	char   *p = ini->data;
+	char   *val;
+	int     nkeys = 0;
+	struct ini_entry *e;
+
+	if(*p == '\0') {
+		p = next(ini, p);
+	}
+
+	/* Count keys and sections to size the tables */
+	while(p < ini->end) {
+		if(*p == '[') {
+			ini->nsections++;
+		} else {
+			nkeys++;
+			p = next(ini, p);
+		}
+		p = next(ini, p);
+	}
+
+	for(ini->index_size = 16; ini->index_size < (size_t)nkeys * 2; ini->index_size <<= 1) {
+		continue;
+	}
+
+	ini->index = calloc(ini->index_size, sizeof(*ini->index));
+	ini->sections = calloc(ini->nsections + 1, sizeof(char *));
+	if(!ini->index || !ini->sections) {
+		return 0;
+	}
+
+	ini->nsections = 0;
+	p = ini->data;
+
+	if(*p == '\0') {
+		p = next(ini, p);
+	}
+
+	while(p < ini->end) {
+		if(*p == '[') {
+			/* Handle section */
+			current_section = p + 1;
+			ini->sections[ini->nsections++] = current_section;
+
+		} else {
+			/* Handle key */
+			val = next(ini, p);
+			e = find_entry(ini, current_section, p);
+			if(!e->key) {
+				e->section = current_section;
+				e->key = p;
+				e->value = val;
+			}
+			p = val;
+		}
+
+		p = next(ini, p);
+	}
+
+	return 1;
+}
+
 ini_t  *ini_load(const char *filename)
 {
 	ini_t  *ini = NULL;
@@ -220,6 +319,9 @@ ini_t  *ini_load(const char *filename)
 
 	/* Prepare data */
 	split_data(ini);
+	if(!build_index(ini)) {
+		goto fail;
+	}
 
 	/* Clean up and return */
 	fclose(fp);
@@ -237,6 +339,8 @@ void ini_free(ini_t *ini)
 {
 	if(ini) {
 		free(ini->data);
+		free(ini->index);
+		free(ini->sections);
 		free(ini);
 	}
 }
@@ -249,6 +353,10 @@ char   *ini_get(const ini_t *ini, const char *section, const char *key)
 	char   *p = ini->data;
 	char   *val;
 
+	if(section) {
+		return find_entry(ini, section, key)->value;
+	}
+
 	if(*p == '\0') {
 		p = next(ini, p);
 	}
@@ -6,6 +6,9 @@
  *
  * Wed Sep 20 02:39:25 PM PDT 2023
  * remove unused ini_sget()
+ *
+ * Mon Oct 19 09:12:40 AM PDT 2026
+ * index (section, key) lookups and section names at load
  */
 
 #ifndef INI_H
@@ -13,9 +16,19 @@
 
 # define	INI_VERSION	"0.1.1"
 
+struct ini_entry {
+	const char *section;
+	const char *key;
+	char   *value;
+};
+
 struct ini_t {
 	char   *data;
 	char   *end;
+	struct ini_entry *index;	/* open addressing, NULL key is empty */
+	size_t  index_size;			/* power of 2 */
+	char  **sections;			/* section names in file order */
+	int     nsections;
 };
 
 typedef struct ini_t ini_t;
@@ -12,8 +12,10 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ini.h"
+#include "namehash.h"
 
 #ifndef PATH_MAX
 # define	PATH_MAX	255
@@ -27,8 +29,6 @@
 # define	STREQ(s1,s2) (strcmp(s1, s2) == 0)
 #endif
 
-static bool duplicate(int, char *, char **);
-
 char   *EmptyStr = "";								/* empty string for strndup, etc */
 
 char   *my_ini(ini_t *ini, char *section, char *key)
@@ -49,51 +49,65 @@ char   *my_ini(ini_t *ini, char *section, char *key)
 	return (p);
 }
 
-int get_sections(ini_t *inidata, int maxsect, char *sections[])
+int get_sections(ini_t *inidata, char ***sectionsp)
 {
-	/* returns a list of INI sections */
+	/*
+	 * returns the number of INI sections, -1 on error
+	 * *sectionsp is an allocated list of the names
+	 */
 
 	char   *p;
+	char  **sections = NULL;
+	char  **tmp;
 	int     i = 0;
+	int     j;
+	int     nalloc = 0;
+	struct namehash seen;							/* duplicate check */
 	bool    validdbname(char *);
 
-	for(p = inidata->data; p < inidata->end; p++)
-		if(*p == '[') {
-			if(p > inidata->data && *(p - 1))		/* line does not start with [ */
-				continue;
+	if(namehash_init(&seen, inidata->nsections) == false) {
+		fprintf(stderr, "get_sections: calloc failed\n");
+		return (-1);
+	}
+
+	/* section names were listed by ini_load() */
+
+	for(j = 0; j < inidata->nsections; j++) {
+		p = inidata->sections[j];
 
-			if(strchr(p, ']'))						/* parser bug: not a real section name */
-				continue;
+		if(strchr(p, ']'))							/* parser bug: not a real section name */
+			continue;
 
-			if(STREQ(p + 1, "global"))				/* global is not a thread */
-				continue;
+		if(STREQ(p, "global"))						/* global is not a thread */
+			continue;
 
-			if(validdbname(p + 1) == false)			/* for sqlite3 */
-				continue;
+		if(validdbname(p) == false)					/* for sqlite3 */
+			continue;
 
-			if(duplicate(i, p + 1, sections))		/* section already exists */
-				continue;
+		if(namehash_find(&seen, p) != -1)			/* section already exists */
+			continue;
 
-			if(i == maxsect) {
-				fprintf(stderr, "too many sections: max %d\n", maxsect);
+		if(i == nalloc) {							/* grow the list */
+			nalloc = nalloc ? nalloc * 2 : 16;
+
+			if((tmp = realloc(sections, nalloc * sizeof(char *))) == NULL) {
+				fprintf(stderr, "get_sections: realloc failed\n");
+				namehash_free(&seen);
+				free(sections);
 				return (-1);
 			}
 
-			sections[i++] = strndup(p + 1, PATH_MAX);
+			sections = tmp;
 		}
 
-	return (i);
-}
-
-static bool duplicate(int nsect, char *s, char *sections[])
-{
-	int     i;
+		sections[i] = strndup(p, PATH_MAX);
+		namehash_add(&seen, sections[i], i);
+		i++;
+	}
 
-	for(i = 0; i < nsect; i++)
-		if(STREQ(s, sections[i]))
-			return (true);
-
-	return (false);
+	namehash_free(&seen);
+	*sectionsp = sections;
+	return (i);
 }
 
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -0,0 +1,492 @@
+/*
+ * metrics.c
+ * Counters and phase latency histograms served on a Unix domain socket.
+ * Section threads update their counters with relaxed atomics.  The main
+ * thread answers clients between threadwait passes, so a reload never
+ * releases a section while it is being reported.
+ *
+ * A request containing "json" gets JSON, anything else, including an
+ * empty request, gets Prometheus text.  An HTTP GET is answered with
+ * HTTP headers, e.g.
+ *   curl --unix-socket /run/sentinal.sock http://localhost/metrics
+ *   echo json | socat - UNIX-CONNECT:/run/sentinal.sock
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sentinal.h"
+
+#define	METRICWAIT	1000							/* ms, main loop tick */
+#define	METRICREQ	512								/* request bytes read */
+
+#define	MD(f)		offsetof(struct metrics, f)
+#define	MVAL(ti,md)	__atomic_load_n((uint64_t *)((char *)&(ti)->ti_metrics + (md)->md_off), __ATOMIC_RELAXED)
+
+struct metricdesc {
+	char   *md_name;								/* prometheus name, json key */
+	char   *md_type;								/* counter or gauge */
+	char   *md_help;
+	size_t  md_off;									/* offset in struct metrics */
+	double  md_div;									/* 1, usec or 1/100 percent */
+	char   *md_thr;									/* thread type reporting it */
+};
+
+static struct metricdesc metricdesc[] = {
+	{ "scans_total", "counter", "Directory scans", MD(mt_scans), 1, NULL },
+	{ "scan_seconds_total", "counter", "Time spent scanning", MD(mt_scanusec), 1e6, NULL },
+	{ "scan_last_seconds", "gauge", "Duration of the latest scan", MD(mt_lastscan), 1e6, NULL },
+	{ "files_seen_total", "counter", "Directory entries seen", MD(mt_seen), 1, NULL },
+	{ "files_matched_total", "counter", "Files matching pcrestr", MD(mt_matched), 1, NULL },
+	{ "files_removed_total", "counter", "Files and directories removed", MD(mt_removed), 1, NULL },
+	{ "bytes_freed_total", "counter", "Size of files removed", MD(mt_freed), 1, NULL },
+	{ "blocks_free_percent", "gauge", "Latest statvfs blocks free", MD(mt_bfree), 100, _DFS_THR },
+	{ "inodes_free_percent", "gauge", "Latest statvfs inodes free", MD(mt_ffree), 100, _DFS_THR },
+	{ "wrk_bytes_total", "counter", "Bytes read from the FIFO", MD(mt_wrkbytes), 1, _WRK_THR },
+	{ "rotations_total", "counter", "Log files closed for postcmd", MD(mt_rotations), 1, NULL },
+	{ "postcmd_total", "counter", "postcmd commands run", MD(mt_postcmds), 1, NULL },
+	{ "postcmd_failures_total", "counter", "postcmd commands with nonzero exit", MD(mt_postfail), 1, NULL },
+	{ "postcmd_seconds_total", "counter", "postcmd run time", MD(mt_postusec), 1e6, NULL },
+	{ "postcmd_wait_seconds_total", "counter", "postcmd time queued", MD(mt_postwait), 1e6, NULL },
+	{ "dblock_waits_total", "counter", "dblock acquisitions", MD(mt_lockwaits), 1, NULL },
+	{ "dblock_wait_seconds_total", "counter", "Time waiting for dblock", MD(mt_lockusec), 1e6, NULL },
+};
+
+#define	NMETRICS	(sizeof(metricdesc) / sizeof(metricdesc[0]))
+
+static char *phasename[NPHASE] = {
+	"readdir", "stat", "insert", "query", "unlink", "rmdir",
+	"walk", "index", "files", "dirs"
+};
+
+static bool metricshow(struct thread_info *, struct metricdesc *);
+static bool phaseshow(struct thread_info *);
+static int phasebucket(uint64_t);
+static void metricjson(FILE *);
+static void metricprom(FILE *);
+static void metricserve(int);
+static void metricvalue(FILE *, struct thread_info *, struct metricdesc *);
+static void phasejson(FILE *, struct thread_info *);
+static void phaseprom(FILE *, char *, bool);
+
+static int metricfd = -1;							/* listening socket */
+static uint64_t starttime;							/* for uptime */
+
+extern int ntinfo;									/* number of sections */
+extern pthread_mutex_t dblock;						/* sqlite lock */
+extern struct thread_info **tinfo;					/* our threads */
+
+uint64_t monotime(void)
+{
+	/* microseconds, for intervals */
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+uint64_t cputime(void)
+{
+	/* microseconds of this thread's CPU time, a system call, use per cycle */
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+static int phasebucket(uint64_t usec)
+{
+	/* bucket i counts samples <= 2^i usec, the le bound is inclusive */
+
+	int     b = usec > 1 ? 64 - __builtin_clzll(usec - 1) : 0;
+
+	return (b < PH_BUCKETS - 1 ? b : PH_BUCKETS - 1);
+}
+
+void phase_add(struct thread_info *ti, enum phase ph, uint64_t wall)
+{
+	/* one per-call sample, wall-clock only */
+
+	struct phasestat *ps = &ti->ti_phase[ph];		/* shorthand */
+
+	__atomic_add_fetch(&ps->ps_count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ps->ps_wall, wall, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ps->ps_hist[phasebucket(wall)], 1, __ATOMIC_RELAXED);
+}
+
+void phase_start(struct phaseclock *pc)
+{
+	pc->pc_wall = monotime();
+	pc->pc_cpu = cputime();
+}
+
+void phase_stop(struct thread_info *ti, enum phase ph, struct phaseclock *pc)
+{
+	/* one per-cycle sample, wall-clock and thread CPU time */
+
+	struct phasestat *ps = &ti->ti_phase[ph];		/* shorthand */
+	uint64_t cpu = cputime() - pc->pc_cpu;
+
+	phase_add(ti, ph, monotime() - pc->pc_wall);
+	__atomic_add_fetch(&ps->ps_cpu, cpu, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ps->ps_cpuhist[phasebucket(cpu)], 1, __ATOMIC_RELAXED);
+}
+
+void phase_snap(struct thread_info *ti, struct phasesnap *sn)
+{
+	int     ph;
+
+	for(ph = 0; ph < NPHASE; ph++) {
+		sn->sn_count[ph] = ti->ti_phase[ph].ps_count;
+		sn->sn_wall[ph] = ti->ti_phase[ph].ps_wall;
+		sn->sn_cpu[ph] = ti->ti_phase[ph].ps_cpu;
+	}
+}
+
+void phase_report(struct thread_info *ti, struct phasesnap *sn)
+{
+	/* one summary line for the phases run since phase_snap() */
+
+	char    buf[BUFSIZ];
+	int     ph;
+	size_t  len = 0;
+	struct phasestat *ps;
+
+	*buf = '\0';
+
+	for(ph = 0; ph < NPHASE && len < sizeof(buf); ph++) {
+		ps = &ti->ti_phase[ph];
+
+		if(ps->ps_count == sn->sn_count[ph])
+			continue;
+
+		if(PH_CYCLE(ph))
+			len += snprintf(buf + len, sizeof(buf) - len, " %s %.3fms cpu %.3fms",
+							phasename[ph], (ps->ps_wall - sn->sn_wall[ph]) / 1e3,
+							(ps->ps_cpu - sn->sn_cpu[ph]) / 1e3);
+		else
+			len += snprintf(buf + len, sizeof(buf) - len, " %s %.3fms/%" PRIu64,
+							phasename[ph], (ps->ps_wall - sn->sn_wall[ph]) / 1e3,
+							ps->ps_count - sn->sn_count[ph]);
+	}
+
+	if(*buf)
+		fprintf(stderr, "%s: timing:%s\n", ti->ti_section, buf);
+}
+
+void dblock_lock(struct thread_info *ti)
+{
+	/* pthread_mutex_lock(&dblock), counting the wait */
+
+	uint64_t start = monotime();
+
+	pthread_mutex_lock(&dblock);
+	METRIC_ADD(ti, mt_lockwaits, 1);
+	METRIC_ADD(ti, mt_lockusec, monotime() - start);
+}
+
+bool metrics_init(char *path)
+{
+	mode_t  mask;
+	struct sockaddr_un addr;
+
+	starttime = monotime();
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "metrics: socket path too long: %s\n", path);
+		return (false);
+	}
+
+	memset(&addr, '\0', sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	if((metricfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		fprintf(stderr, "metrics: can't create socket\n");
+		return (false);
+	}
+
+	unlink(path);									/* left by a previous run, we hold the pidfile */
+
+	mask = umask(0117);								/* srw-rw---- */
+
+	if(bind(metricfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	   listen(metricfd, 8) == -1) {
+		fprintf(stderr, "metrics: can't listen on %s\n", path);
+		umask(mask);
+		close(metricfd);
+		metricfd = -1;
+		return (false);
+	}
+
+	umask(mask);
+	fprintf(stderr, "metrics: listening on %s\n", path);
+	return (true);
+}
+
+void metrics_wait(void)
+{
+	/* the main loop tick: wait a second, answering clients as they come */
+
+	int     cfd;
+	struct pollfd pfd;
+	struct timeval tv = { 1, 0 };					/* client read and write limit */
+
+	if(metricfd == -1) {
+		sleep(1);
+		return;
+	}
+
+	pfd.fd = metricfd;
+	pfd.events = POLLIN;
+
+	if(poll(&pfd, 1, METRICWAIT) <= 0)
+		return;
+
+	while((cfd = accept4(metricfd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+		setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		metricserve(cfd);
+		close(cfd);
+	}
+}
+
+static void metricserve(int cfd)
+{
+	bool    http;									/* answer with headers */
+	bool    json;									/* else prometheus */
+	char    req[METRICREQ];							/* request */
+	char   *body = NULL;							/* formatted metrics */
+	char   *p;
+	FILE   *fp;
+	size_t  len = 0;
+	ssize_t n;
+
+	if((n = read(cfd, req, sizeof(req) - 1)) < 0)
+		n = 0;
+
+	req[n] = '\0';
+
+	if((p = strpbrk(req, "\r\n")))					/* first line only */
+		*p = '\0';
+
+	http = strncmp(req, "GET ", 4) == 0;
+	json = strstr(req, "json") != NULL;
+
+	if((fp = open_memstream(&body, &len)) == NULL)
+		return;
+
+	if(json)
+		metricjson(fp);
+	else
+		metricprom(fp);
+
+	fclose(fp);
+
+	if(http)
+		dprintf(cfd, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+				"Content-Length: %zu\r\nConnection: close\r\n\r\n",
+				json ? "application/json" : "text/plain; version=0.0.4", len);
+
+	for(p = body; len > 0; p += n, len -= n)
+		if((n = write(cfd, p, len)) <= 0)
+			break;
+
+	free(body);
+}
+
+static bool phaseshow(struct thread_info *ti)
+{
+	/* phases are timed in dfs and exp threads */
+
+	return (threadtype(ti, _DFS_THR) || threadtype(ti, _EXP_THR));
+}
+
+static bool metricshow(struct thread_info *ti, struct metricdesc *md)
+{
+	/* thread specific readings only for sections running that thread */
+
+	return (md->md_thr == NULL || threadtype(ti, md->md_thr));
+}
+
+static void metricvalue(FILE *fp, struct thread_info *ti, struct metricdesc *md)
+{
+	uint64_t v = MVAL(ti, md);
+
+	if(md->md_div == 1)
+		fprintf(fp, "%" PRIu64, v);
+	else
+		fprintf(fp, "%.6f", (double)v / md->md_div);
+}
+
+static void metricprom(FILE *fp)
+{
+	int     i;
+	size_t  m;
+	struct metricdesc *md;
+
+	fprintf(fp, "# HELP sentinal_uptime_seconds Time since start\n");
+	fprintf(fp, "# TYPE sentinal_uptime_seconds gauge\n");
+	fprintf(fp, "sentinal_uptime_seconds %.3f\n", (monotime() - starttime) / 1e6);
+	fprintf(fp, "# HELP sentinal_sections Sections running\n");
+	fprintf(fp, "# TYPE sentinal_sections gauge\n");
+	fprintf(fp, "sentinal_sections %d\n", ntinfo);
+	fprintf(fp, "# HELP sentinal_postcmd_queue_depth postcmd jobs waiting\n");
+	fprintf(fp, "# TYPE sentinal_postcmd_queue_depth gauge\n");
+	fprintf(fp, "sentinal_postcmd_queue_depth %d\n", postqueue_depth());
+
+	for(m = 0; m < NMETRICS; m++) {
+		md = &metricdesc[m];
+		fprintf(fp, "# HELP sentinal_%s %s\n", md->md_name, md->md_help);
+		fprintf(fp, "# TYPE sentinal_%s %s\n", md->md_name, md->md_type);
+
+		for(i = 0; i < ntinfo; i++) {
+			if(!metricshow(tinfo[i], md))
+				continue;
+
+			/* section names are valid sqlite table names, no escapes */
+
+			fprintf(fp, "sentinal_%s{section=\"%s\"} ", md->md_name, tinfo[i]->ti_section);
+			metricvalue(fp, tinfo[i], md);
+			fputc('\n', fp);
+		}
+	}
+
+	phaseprom(fp, "phase_seconds", false);
+	phaseprom(fp, "phase_cpu_seconds", true);
+}
+
+static void phaseprom(FILE *fp, char *name, bool cpu)
+{
+	/* histograms, phases without samples are left out */
+
+	int     b;
+	int     i;
+	int     ph;
+	struct phasestat *ps;
+	uint64_t cum;									/* cumulative bucket count */
+
+	fprintf(fp, "# HELP sentinal_%s %s by phase\n", name,
+			cpu ? "Thread CPU time per scan cycle" : "Wall-clock time per call or cycle");
+	fprintf(fp, "# TYPE sentinal_%s histogram\n", name);
+
+	for(i = 0; i < ntinfo; i++) {
+		if(!phaseshow(tinfo[i]))
+			continue;
+
+		for(ph = 0; ph < NPHASE; ph++) {
+			ps = &tinfo[i]->ti_phase[ph];
+
+			if((cpu && !PH_CYCLE(ph)) || ps->ps_count == 0)
+				continue;
+
+			for(cum = 0, b = 0; b < PH_BUCKETS; b++) {
+				cum += cpu ? ps->ps_cpuhist[b] : ps->ps_hist[b];
+
+				if(b < PH_BUCKETS - 1)
+					fprintf(fp, "sentinal_%s_bucket{section=\"%s\",phase=\"%s\",le=\"%g\"} %"
+							PRIu64 "\n", name, tinfo[i]->ti_section, phasename[ph],
+							(double)(1ULL << b) / 1e6, cum);
+				else
+					fprintf(fp, "sentinal_%s_bucket{section=\"%s\",phase=\"%s\",le=\"+Inf\"} %"
+							PRIu64 "\n", name, tinfo[i]->ti_section, phasename[ph], cum);
+			}
+
+			fprintf(fp, "sentinal_%s_sum{section=\"%s\",phase=\"%s\"} %.6f\n", name,
+					tinfo[i]->ti_section, phasename[ph],
+					(cpu ? ps->ps_cpu : ps->ps_wall) / 1e6);
+			fprintf(fp, "sentinal_%s_count{section=\"%s\",phase=\"%s\"} %" PRIu64 "\n",
+					name, tinfo[i]->ti_section, phasename[ph], cum);
+		}
+	}
+}
+
+static void metricjson(FILE *fp)
+{
+	int     i;
+	size_t  m;
+	struct metricdesc *md;
+
+	fprintf(fp, "{\"uptime_seconds\":%.3f,\"sections\":%d,\"postcmd_queue_depth\":%d,",
+			(monotime() - starttime) / 1e6, ntinfo, postqueue_depth());
+	fprintf(fp, "\"section\":{");
+
+	for(i = 0; i < ntinfo; i++) {
+		fprintf(fp, "%s\"%s\":{", i ? "," : "", tinfo[i]->ti_section);
+
+		for(m = 0; m < NMETRICS; m++) {
+			md = &metricdesc[m];
+
+			if(!metricshow(tinfo[i], md))
+				continue;
+
+			fprintf(fp, "%s\"%s\":", m ? "," : "", md->md_name);
+			metricvalue(fp, tinfo[i], md);
+		}
+
+		if(phaseshow(tinfo[i]))
+			phasejson(fp, tinfo[i]);
+
+		fputc('}', fp);
+	}
+
+	fprintf(fp, "}}\n");
+}
+
+static void phasejson(FILE *fp, struct thread_info *ti)
+{
+	/* bucket b counts samples <= 2^b usec, the last is unbounded */
+
+	int     b;
+	int     ph;
+	struct phasestat *ps;
+
+	fprintf(fp, ",\"phase\":{");
+
+	for(ph = 0; ph < NPHASE; ph++) {
+		ps = &ti->ti_phase[ph];
+		fprintf(fp, "%s\"%s\":{\"count\":%" PRIu64 ",\"wall_seconds\":%.6f,\"buckets\":[",
+				ph ? "," : "", phasename[ph], ps->ps_count, ps->ps_wall / 1e6);
+
+		for(b = 0; b < PH_BUCKETS; b++)
+			fprintf(fp, "%s%" PRIu64, b ? "," : "", ps->ps_hist[b]);
+
+		fputc(']', fp);
+
+		if(PH_CYCLE(ph)) {
+			fprintf(fp, ",\"cpu_seconds\":%.6f,\"cpu_buckets\":[", ps->ps_cpu / 1e6);
+
+			for(b = 0; b < PH_BUCKETS; b++)
+				fprintf(fp, "%s%" PRIu64, b ? "," : "", ps->ps_cpuhist[b]);
+
+			fputc(']', fp);
+		}
+
+		fputc('}', fp);
+	}
+
+	fputc('}', fp);
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -0,0 +1,85 @@
+/*
+ * namehash.c
+ * Section name lookup in O(1).  The table is sized for a known maximum
+ * number of keys and never grows; keys are not copied.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "namehash.h"
+
+static uint32_t fnv1a(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while(*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return (h);
+}
+
+bool namehash_init(struct namehash *nh, int nkeys)
+{
+	/* at most half full */
+
+	for(nh->nh_size = 16; nh->nh_size < nkeys * 2; nh->nh_size <<= 1)
+		continue;
+
+	nh->nh_name = calloc(nh->nh_size, sizeof(char *));
+	nh->nh_index = calloc(nh->nh_size, sizeof(int));
+
+	if(nh->nh_name == NULL || nh->nh_index == NULL) {
+		namehash_free(nh);
+		return (false);
+	}
+
+	return (true);
+}
+
+int namehash_find(struct namehash *nh, const char *name)
+{
+	/* index of name, -1 if not found */
+
+	uint32_t h;
+	uint32_t mask = nh->nh_size - 1;
+
+	for(h = fnv1a(name) & mask; nh->nh_name[h]; h = (h + 1) & mask)
+		if(strcmp(nh->nh_name[h], name) == 0)
+			return (nh->nh_index[h]);
+
+	return (-1);
+}
+
+bool namehash_add(struct namehash *nh, const char *name, int index)
+{
+	/* false if name is already present */
+
+	uint32_t h;
+	uint32_t mask = nh->nh_size - 1;
+
+	for(h = fnv1a(name) & mask; nh->nh_name[h]; h = (h + 1) & mask)
+		if(strcmp(nh->nh_name[h], name) == 0)
+			return (false);
+
+	nh->nh_name[h] = name;
+	nh->nh_index[h] = index;
+	return (true);
+}
+
+void namehash_free(struct namehash *nh)
+{
+	free(nh->nh_name);
+	free(nh->nh_index);
+	nh->nh_name = NULL;
+	nh->nh_index = NULL;
+	nh->nh_size = 0;
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -0,0 +1,30 @@
+/*
+ * namehash.h
+ * Fixed-size open addressing table: section name -> index.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#ifndef NAMEHASH_H
+# define	NAMEHASH_H
+
+# include <stdbool.h>
+
+struct namehash {
+	const char **nh_name;							/* keys, NULL is empty */
+	int    *nh_index;								/* values */
+	int     nh_size;								/* power of 2 */
+};
+
+bool    namehash_add(struct namehash *, const char *, int);
+int     namehash_find(struct namehash *, const char *);
+void    namehash_free(struct namehash *);
+bool    namehash_init(struct namehash *, int);
+
+#endif												/* NAMEHASH_H */
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
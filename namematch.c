@@ -15,21 +15,10 @@
 
 bool namematch(struct thread_info *ti, char *f)
 {
-	int     rc;
-	pcre2_match_data *mdata;
-	uint32_t options = 0;
-
-	if(IS_NULL(f) || *f == '.' || ti->ti_pcrecmp == NULL)
-		return (false);
-
-	if((mdata = pcre2_match_data_create_from_pattern(ti->ti_pcrecmp, NULL)) == NULL)
+	if(IS_NULL(f) || *f == '.')
 		return (false);
 
-	rc = pcre2_match(ti->ti_pcrecmp, (PCRE2_SPTR) f, strlen(f), (PCRE2_SIZE) 0, options,
-					 mdata, NULL);
-
-	pcre2_match_data_free(mdata);
-	return (rc >= 0);
+	return (pcrematch(ti, f));						/* false if ti_pcrecmp is NULL */
 }
 
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
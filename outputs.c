@@ -32,7 +32,6 @@ static char *thread_types[] = {
 static int ntypes = sizeof(thread_types) / sizeof(thread_types[0]);
 
 /* externals */
-extern struct thread_info tinfo[MAXSECT];			/* our threads */
 extern struct utsname utsbuf;						/* for host info */
 
 char   *my_ini(ini_t *, char *, char *);
@@ -45,6 +44,8 @@ void debug_global(ini_t *inidata, char *inifile)
 	fprintf(stdout, "[global]\n");
 	fprintf(stdout, "pidfile   = %s\n", my_ini(inidata, "global", "pidfile"));
 	fprintf(stdout, "database  = %s\n", my_ini(inidata, "global", "database"));
+	DPRINTSTR(stdout, "sharedscan = %s\n", my_ini(inidata, "global", "sharedscan"));
+	DPRINTSTR(stdout, "pcrelib   = %s\n", my_ini(inidata, "global", "pcrelib"));
 }
 
 void debug_section(ini_t *inidata, char *section)
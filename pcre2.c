@@ -15,10 +15,17 @@
  *
  * Sat Apr 18 07:24:21 PM PDT 2026
  * codex
+ *
+ * Mon Oct 19 02:10:00 AM PDT 2026
+ * JIT compilation; compiled patterns kept in a small LRU cache per
+ * connection, shared by every statement, instead of per-statement
+ * auxdata; REGEXP_EXTRACT(subject, pattern [, group]) and
+ * REGEXP_REPLACE(subject, pattern, replacement)
  */
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <assert.h>
+#include <string.h>
 #include <pcre2.h>
 #include <sqlite3ext.h>
 
@@ -30,38 +37,61 @@
 #define SQLITE_DETERMINISTIC 0
 #endif
 
+#define REGEXP_CACHE_SIZE 16						/* compiled patterns per connection */
+
 SQLITE_EXTENSION_INIT1 typedef struct {
+	char   *pattern_str;							/* cache key, NULL if the slot is empty */
+	int     pattern_len;
 	pcre2_code *pattern_code;
-	pcre2_match_data *match_data;
+	pcre2_match_data *match_data;					/* sized for the pattern's groups */
+	sqlite3_uint64 last_used;						/* for LRU eviction */
+} regexp_entry;
+
+typedef struct {
+	regexp_entry entries[REGEXP_CACHE_SIZE];
+	sqlite3_uint64 clock;							/* lookups so far */
+	int     last_hit;								/* checked first */
+	int     refs;									/* functions sharing the cache */
 } regexp_cache;
 
+static void free_regexp_entry(regexp_entry *entry)
+{
+	if(entry->match_data)
+		pcre2_match_data_free(entry->match_data);
+
+	if(entry->pattern_code)
+		pcre2_code_free(entry->pattern_code);
+
+	sqlite3_free(entry->pattern_str);
+	memset(entry, 0, sizeof(*entry));
+}
+
 static void free_regexp_cache(void *arg)
 {
+	/* called once for each function when the connection closes */
+
+	int     i;
 	regexp_cache *cache = arg;
 
-	if(cache == NULL)
+	if(cache == NULL || --cache->refs > 0)
 		return;
 
-	if(cache->match_data)
-		pcre2_match_data_free(cache->match_data);
-
-	if(cache->pattern_code)
-		pcre2_code_free(cache->pattern_code);
+	for(i = 0; i < REGEXP_CACHE_SIZE; i++)
+		free_regexp_entry(&cache->entries[i]);
 
 	sqlite3_free(cache);
 }
 
-static regexp_cache *compile_regexp(sqlite3_context *ctx, sqlite3_value *value)
+static regexp_entry *compile_regexp(sqlite3_context *ctx, sqlite3_value *value)
 {
 	const unsigned char *pattern_str;
 	int     error_code;
+	int     i;
 	int     pattern_len;
+	int     victim = 0;
 	PCRE2_SIZE error_position;
-	regexp_cache *cache;
-
-	cache = sqlite3_get_auxdata(ctx, 0);
-	if(cache)
-		return (cache);
+	regexp_cache *cache = sqlite3_user_data(ctx);
+	regexp_entry *entry;
 
 	pattern_str = sqlite3_value_text(value);
 	if(!pattern_str) {
@@ -70,17 +100,37 @@ static regexp_cache *compile_regexp(sqlite3_context *ctx, sqlite3_value *value)
 	}
 
 	pattern_len = sqlite3_value_bytes(value);
-	cache = sqlite3_malloc(sizeof(*cache));
-	if(cache == NULL) {
-		sqlite3_result_error_nomem(ctx);
-		return (NULL);
+	cache->clock++;
+
+	/* the same pattern row after row is the common case */
+
+	entry = &cache->entries[cache->last_hit];
+	if(entry->pattern_str && entry->pattern_len == pattern_len &&
+	   memcmp(entry->pattern_str, pattern_str, pattern_len) == 0) {
+		entry->last_used = cache->clock;
+		return (entry);
 	}
 
-	cache->pattern_code = NULL;
-	cache->match_data = NULL;
-	cache->pattern_code = pcre2_compile(pattern_str, pattern_len, 0,
+	for(i = 0; i < REGEXP_CACHE_SIZE; i++) {
+		entry = &cache->entries[i];
+
+		if(entry->pattern_str && entry->pattern_len == pattern_len &&
+		   memcmp(entry->pattern_str, pattern_str, pattern_len) == 0) {
+			entry->last_used = cache->clock;
+			cache->last_hit = i;
+			return (entry);
+		}
+
+		if(entry->last_used < cache->entries[victim].last_used)
+			victim = i;								/* empty slots have last_used 0 */
+	}
+
+	entry = &cache->entries[victim];
+	free_regexp_entry(entry);
+
+	entry->pattern_code = pcre2_compile(pattern_str, pattern_len, 0,
 										&error_code, &error_position, NULL);
-	if(cache->pattern_code == NULL) {
+	if(entry->pattern_code == NULL) {
 		PCRE2_UCHAR error_buffer[256];
 		char   *message;
 
@@ -89,25 +139,42 @@ static regexp_cache *compile_regexp(sqlite3_context *ctx, sqlite3_value *value)
 								  pattern_str, (int)error_position, error_buffer);
 		sqlite3_result_error(ctx, message, -1);
 		sqlite3_free(message);
-		sqlite3_free(cache);
 		return (NULL);
 	}
 
-	cache->match_data = pcre2_match_data_create_from_pattern(cache->pattern_code, NULL);
-	if(cache->match_data == NULL) {
-		pcre2_code_free(cache->pattern_code);
+	pcre2_jit_compile(entry->pattern_code, PCRE2_JIT_COMPLETE);	/* interpreted if this fails */
+
+	entry->match_data = pcre2_match_data_create_from_pattern(entry->pattern_code, NULL);
+	entry->pattern_str = sqlite3_malloc(pattern_len + 1);
+	if(entry->match_data == NULL || entry->pattern_str == NULL) {
+		free_regexp_entry(entry);
 		sqlite3_result_error_nomem(ctx);
-		sqlite3_free(cache);
 		return (NULL);
 	}
 
-	sqlite3_set_auxdata(ctx, 0, cache, free_regexp_cache);
-	return (cache);
+	memcpy(entry->pattern_str, pattern_str, pattern_len + 1);
+	entry->pattern_len = pattern_len;
+	entry->last_used = cache->clock;
+	cache->last_hit = victim;
+	return (entry);
+}
+
+static void match_error(sqlite3_context *ctx, int rc)
+{
+	PCRE2_UCHAR error_buffer[256];
+	char   *message;
+
+	pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
+	message = sqlite3_mprintf("%s", error_buffer);
+	sqlite3_result_error(ctx, message, -1);
+	sqlite3_free(message);
 }
 
 static void regexp(sqlite3_context *ctx, int argc, sqlite3_value **argv)
 {
-	regexp_cache *cache;
+	/* X REGEXP Y calls regexp(Y, X) */
+
+	regexp_entry *entry;
 	const unsigned char *subject_str;
 	int     rc;
 	int     subject_len;
@@ -118,8 +185,8 @@ static void regexp(sqlite3_context *ctx, int argc, sqlite3_value **argv)
 	   sqlite3_value_type(argv[1]) == SQLITE_NULL)
 		return;
 
-	cache = compile_regexp(ctx, argv[0]);
-	if(cache == NULL)
+	entry = compile_regexp(ctx, argv[0]);
+	if(entry == NULL)
 		return;
 
 	subject_str = sqlite3_value_text(argv[1]);
@@ -129,32 +196,187 @@ static void regexp(sqlite3_context *ctx, int argc, sqlite3_value **argv)
 	}
 
 	subject_len = sqlite3_value_bytes(argv[1]);
-	rc = pcre2_match(cache->pattern_code, subject_str, subject_len, 0, 0,
-					 cache->match_data, NULL);
+	rc = pcre2_match(entry->pattern_code, subject_str, subject_len, 0, 0,
+					 entry->match_data, NULL);
 
 	if(rc >= 0) {
 		sqlite3_result_int(ctx, 1);
 	} else if(rc == PCRE2_ERROR_NOMATCH) {
 		sqlite3_result_int(ctx, 0);
 	} else {
-		PCRE2_UCHAR error_buffer[256];
-		char   *message;
+		match_error(ctx, rc);
+	}
+}
 
-		pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
-		message = sqlite3_mprintf("%s", error_buffer);
-		sqlite3_result_error(ctx, message, -1);
-		sqlite3_free(message);
+static void regexp_extract(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	/*
+	 * REGEXP_EXTRACT(subject, pattern [, group])
+	 * group defaults to 1 if the pattern has groups, else the whole match
+	 * NULL if there is no match or the group did not take part
+	 */
+
+	regexp_entry *entry;
+	const unsigned char *subject_str;
+	int     group;
+	int     rc;
+	int     subject_len;
+	PCRE2_SIZE *ovector;
+	uint32_t groups = 0;
+
+	assert(argc == 2 || argc == 3);
+
+	if(sqlite3_value_type(argv[0]) == SQLITE_NULL ||
+	   sqlite3_value_type(argv[1]) == SQLITE_NULL)
+		return;
+
+	entry = compile_regexp(ctx, argv[1]);
+	if(entry == NULL)
+		return;
+
+	pcre2_pattern_info(entry->pattern_code, PCRE2_INFO_CAPTURECOUNT, &groups);
+	group = argc == 3 ? sqlite3_value_int(argv[2]) : groups > 0;
+
+	if(group < 0 || (uint32_t)group > groups) {
+		sqlite3_result_error(ctx, "no such group", -1);
+		return;
 	}
+
+	subject_str = sqlite3_value_text(argv[0]);
+	if(!subject_str) {
+		sqlite3_result_error(ctx, "no subject", -1);
+		return;
+	}
+
+	subject_len = sqlite3_value_bytes(argv[0]);
+	rc = pcre2_match(entry->pattern_code, subject_str, subject_len, 0, 0,
+					 entry->match_data, NULL);
+
+	if(rc == PCRE2_ERROR_NOMATCH)
+		return;
+
+	if(rc < 0) {
+		match_error(ctx, rc);
+		return;
+	}
+
+	ovector = pcre2_get_ovector_pointer(entry->match_data);
+
+	if(group >= rc || ovector[2 * group] == PCRE2_UNSET)
+		return;
+
+	sqlite3_result_text(ctx, (const char *)subject_str + ovector[2 * group],
+						(int)(ovector[2 * group + 1] - ovector[2 * group]), SQLITE_TRANSIENT);
+}
+
+static void regexp_replace(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	/*
+	 * REGEXP_REPLACE(subject, pattern, replacement)
+	 * every match is replaced, $1 or ${name} in replacement for groups
+	 */
+
+	regexp_entry *entry;
+	const unsigned char *replace_str;
+	const unsigned char *subject_str;
+	int     rc;
+	int     replace_len;
+	int     subject_len;
+	PCRE2_SIZE out_len;
+	PCRE2_UCHAR *out;
+	uint32_t options = PCRE2_SUBSTITUTE_GLOBAL | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH;
+
+	assert(argc == 3);
+
+	if(sqlite3_value_type(argv[0]) == SQLITE_NULL ||
+	   sqlite3_value_type(argv[1]) == SQLITE_NULL ||
+	   sqlite3_value_type(argv[2]) == SQLITE_NULL)
+		return;
+
+	entry = compile_regexp(ctx, argv[1]);
+	if(entry == NULL)
+		return;
+
+	subject_str = sqlite3_value_text(argv[0]);
+	replace_str = sqlite3_value_text(argv[2]);
+	if(!subject_str || !replace_str) {
+		sqlite3_result_error(ctx, "no subject", -1);
+		return;
+	}
+
+	subject_len = sqlite3_value_bytes(argv[0]);
+	replace_len = sqlite3_value_bytes(argv[2]);
+
+	/* a second try when the first buffer is short, out_len is then the need */
+
+	out_len = subject_len + replace_len + 1;
+
+	for(;;) {
+		if((out = sqlite3_malloc64(out_len)) == NULL) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+
+		rc = pcre2_substitute(entry->pattern_code, subject_str, subject_len, 0, options,
+							  entry->match_data, NULL, replace_str, replace_len, out, &out_len);
+
+		if(rc != PCRE2_ERROR_NOMEMORY)
+			break;
+
+		sqlite3_free(out);
+		options &= ~PCRE2_SUBSTITUTE_OVERFLOW_LENGTH;	/* out_len is exact now */
+	}
+
+	if(rc < 0) {
+		sqlite3_free(out);
+		match_error(ctx, rc);
+		return;
+	}
+
+	sqlite3_result_text(ctx, (const char *)out, (int)out_len, sqlite3_free);
 }
 
 int sqlite3_extension_init(sqlite3 *db, char **err, const sqlite3_api_routines *api)
 {
+	int     flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+	int     rc;
+	regexp_cache *cache;
+
 	SQLITE_EXTENSION_INIT2(api)
 		(void)err;
 
-	return sqlite3_create_function(db, "REGEXP", 2,
-								   SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-								   NULL, regexp, NULL, NULL);
+	/*
+	 * one cache per connection, freed by the last function to go
+	 * sqlite calls free_regexp_cache() for a failed registration
+	 */
+
+	if((cache = sqlite3_malloc(sizeof(*cache))) == NULL)
+		return (SQLITE_NOMEM);
+
+	memset(cache, 0, sizeof(*cache));
+	cache->refs = 4;
+
+	rc = sqlite3_create_function_v2(db, "REGEXP", 2, flags, cache, regexp, NULL, NULL,
+									free_regexp_cache);
+	if(rc == SQLITE_OK)
+		rc = sqlite3_create_function_v2(db, "REGEXP_EXTRACT", 2, flags, cache,
+										regexp_extract, NULL, NULL, free_regexp_cache);
+	else
+		free_regexp_cache(cache);					/* never registered */
+
+	if(rc == SQLITE_OK)
+		rc = sqlite3_create_function_v2(db, "REGEXP_EXTRACT", 3, flags, cache,
+										regexp_extract, NULL, NULL, free_regexp_cache);
+	else
+		free_regexp_cache(cache);					/* never registered */
+
+	if(rc == SQLITE_OK)
+		rc = sqlite3_create_function_v2(db, "REGEXP_REPLACE", 3, flags, cache,
+										regexp_replace, NULL, NULL, free_regexp_cache);
+	else
+		free_regexp_cache(cache);					/* never registered */
+
+	return (rc);
 }
 
 /* vim: set tabstop=4 shiftwidth=4 expandtab: */
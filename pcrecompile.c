@@ -1,8 +1,12 @@
 /*
  * pcrecompile.c
  * Check and compile a regex for later use.
+ * JIT-compiled when pcre2 supports it, pcre2_match() uses the JIT code.
+ * The pattern is also scanned once for a literal every match must
+ * contain, and for pcre2's first and required code units, so that
+ * pcrematch() can reject most names without calling pcre2.
  *
- * Copyright (c) 2021-2024 jjb
+ * Copyright (c) 2021-2026 jjb
  * All rights reserved.
  *
  * This source code is licensed under the MIT license found
@@ -10,16 +14,26 @@
  */
 
 #include <stdio.h>
+#include <ctype.h>
 #include <string.h>
 #include "sentinal.h"
 
+#define	SAFEESCAPES	"dDwWsShHvVbBAzZGRXnrtefaK"	/* \x that consume two characters */
+
+static void pcrefilter(struct thread_info *);
+static void pcreliteral(struct pcrefilter *, char *);
+
 bool pcrecompile(struct thread_info *ti)
 {
 	PCRE2_SIZE erroffset;
 	PCRE2_SIZE length = PCRE2_ZERO_TERMINATED;
 	int     errnumber;
+	uint32_t jit = 0;
 	uint32_t options = 0;
 
+	memset(&ti->ti_pcrefilter, '\0', sizeof(struct pcrefilter));
+	ti->ti_pcrefilter.pf_first = ti->ti_pcrefilter.pf_last = -1;
+
 	if(IS_NULL(ti->ti_pcrestr)) {
 		/*
 		 * null is ok -- ensures namematch() always returns false
@@ -33,9 +47,165 @@ bool pcrecompile(struct thread_info *ti)
 		if(ti->ti_pcrecmp == NULL)
 			fprintf(stderr, "%s: pcre2 compilation failed: %s\n",
 					ti->ti_section, ti->ti_pcrestr);
+		else {
+			if(pcre2_config(PCRE2_CONFIG_JIT, &jit) == 0 && jit)
+				pcre2_jit_compile(ti->ti_pcrecmp, PCRE2_JIT_COMPLETE);	/* interpreted if this fails */
+
+			pcrefilter(ti);
+		}
 	}
 
 	return (ti->ti_pcrecmp != NULL);
 }
 
+static void pcrefilter(struct thread_info *ti)
+{
+	/*
+	 * groups can hide alternatives from pcreliteral(), and inline
+	 * options, (?i) in particular, can make pcre2's code units caseless
+	 */
+
+	struct pcrefilter *pf = &ti->ti_pcrefilter;	/* shorthand */
+	uint32_t type;
+	uint32_t unit;
+
+	if(!strpbrk(ti->ti_pcrestr, "(|") && !strstr(ti->ti_pcrestr, "\\Q"))
+		pcreliteral(pf, ti->ti_pcrestr);
+
+	if(strstr(ti->ti_pcrestr, "(?"))
+		return;
+
+	if(pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_FIRSTCODETYPE, &type) == 0 && type == 1 &&
+	   pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_FIRSTCODEUNIT, &unit) == 0)
+		pf->pf_first = (int)unit;
+
+	if(pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_LASTCODETYPE, &type) == 0 && type == 1 &&
+	   pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_LASTCODEUNIT, &unit) == 0)
+		pf->pf_last = (int)unit;
+}
+
+static void pcreliteral(struct pcrefilter *pf, char *p)
+{
+	/*
+	 * longest run of unquantified literal characters in a pattern
+	 * without groups or alternation, noting ^ and $ anchors
+	 * anything not understood ends the run, or gives up
+	 */
+
+	bool    anchored = false;						/* run starts at ^ */
+	bool    full = false;							/* run was truncated */
+	bool    lit;									/* atom is one literal character */
+	char    c = '\0';
+	char   *q;
+	char    run[PCRELITMAX];
+	int     anchor = 0;
+	size_t  len = 0;
+
+	if(*p == '^') {
+		anchored = true;
+		p++;
+	}
+
+	for(;;) {
+		if(*p == '$' && p[1] == '\0')
+			anchor = PF_END;
+
+		if(*p == '\0' || anchor == PF_END) {
+			if(full)
+				anchor = 0;
+
+			break;
+		}
+
+		/* one atom */
+
+		lit = false;
+
+		if(*p == '\\') {
+			if(p[1] == '\0')
+				return;
+
+			if(isalnum((unsigned char)p[1]) && strchr(SAFEESCAPES, p[1]) == NULL)
+				return;								/* \x41, \1, \pL, \k<n>, ... */
+
+			lit = !isalnum((unsigned char)p[1]);
+			c = p[1];
+			p += 2;
+		} else if(*p == '[') {
+			p++;
+
+			if(*p == '^')
+				p++;
+
+			if(*p == ']')
+				p++;
+
+			for(; *p && *p != ']'; p++)
+				if(*p == '\\' && p[1])
+					p++;
+				else if(*p == '[' && p[1] == ':') {
+					if((q = strstr(p, ":]")) == NULL)
+						return;
+					p = q + 1;						/* [:alpha:] */
+				}
+
+			if(*p++ != ']')
+				return;
+		} else if(*p == '{') {
+			if((p = strchr(p, '}')) == NULL)
+				return;
+			p++;									/* a stray quantifier */
+		} else if(strchr(".^$*+?", *p))
+			p++;
+		else {
+			lit = true;
+			c = *p++;
+		}
+
+		/* a quantified atom is optional or repeated */
+
+		if(*p && strchr("*+?{", *p)) {
+			lit = false;
+
+			if(*p == '{') {
+				if((p = strchr(p, '}')) == NULL)
+					return;
+				p++;
+			} else
+				p++;
+
+			if(*p == '+' || *p == '?')
+				p++;								/* possessive or lazy */
+		}
+
+		if(lit) {
+			if(len < PCRELITMAX)
+				run[len++] = c;
+			else
+				full = true;
+			continue;
+		}
+
+		/* keep the longest run, prefer an anchored one */
+
+		if(len > pf->pf_len || (len == pf->pf_len && anchored && len)) {
+			memcpy(pf->pf_lit, run, len);
+			pf->pf_len = len;
+			pf->pf_anchor = anchored ? PF_START : 0;
+		}
+
+		anchored = full = false;
+		len = 0;
+	}
+
+	if(anchored)
+		anchor |= PF_START;
+
+	if(len > pf->pf_len || (len == pf->pf_len && anchor && len)) {
+		memcpy(pf->pf_lit, run, len);
+		pf->pf_len = len;
+		pf->pf_anchor = anchor;
+	}
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -1,41 +1,125 @@
 /*
  * pcrefind.c
  * Program to find files matching Perl-compatible regular expressions.
+ * A pool of threads walks the tree; each thread takes a directory from
+ * a shared stack, tests its entries and pushes the subdirectories it
+ * finds.  Output is sorted after the walk unless --unordered is given,
+ * in which case each thread writes its own large buffer as it fills.
  *
- * Copyright (c) 2021-2025 jjb
+ * --stats walks an INI section's dirname the way findfile() does and
+ * runs the exp and dfs retention decisions, see expdecide.c, over the
+ * files in memory: what sentinal would remove, without removing it.
+ *
+ * Copyright (c) 2021-2026 jjb
  * All rights reserved.
  *
  * This source code is licensed under the MIT license found
  * in the root directory of this source tree.
  */
 
+#define	_GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "sentinal.h"
 #include "basename.h"
+#include "ini.h"
+
+#define	MAXJOBS		256								/* --jobs limit */
+#define	OUTBUFSIZ	(1024 * 1024)					/* per thread, --unordered */
+
+struct dirjob {
+	struct dirjob *dj_next;							/* stack link */
+	char    dj_path[];								/* directory */
+};
 
+struct statfile {
+	size_t  sf_off;									/* path in fd_buf, relative to dirname */
+	size_t  sf_dirlen;								/* its directory part, 0 at the top */
+	char   *sf_path;								/* set after the walk */
+	off_t   sf_size;
+	blkcnt_t sf_blocks;								/* 512 byte blocks, for dfs */
+	time_t  sf_mtime;								/* db_time */
+};
+
+struct finder {
+	char   *fd_buf;									/* --unordered output, or sorted paths */
+	size_t  fd_len;
+	size_t  fd_size;
+	size_t *fd_offs;								/* sorted: path offsets in fd_buf */
+	size_t  fd_noffs;
+	size_t  fd_maxoffs;
+	uint64_t fd_count;								/* matches */
+	struct statfile *fd_files;						/* --stats */
+	size_t  fd_nfiles;
+	size_t  fd_maxfiles;
+};
+
+char   *my_ini(ini_t *, char *, char *);
+
+static bool keeppath(struct finder *, char *, size_t, size_t *);
+static struct dirjob *newdir(char *, size_t, struct dirjob *);
+static bool addfile(struct finder *, char *, size_t, size_t, struct stat *);
+static bool addpath(struct finder *, char *, size_t);
+static bool statsini(struct thread_info *, char *, char *);
+static bool flushout(struct finder *);
+static int cmpdir(const void *, const void *);
+static int cmppath(const void *, const void *);
+static int cmptime(const void *, const void *);
+static char *fmttime(time_t, char *);
+static uint64_t pcrefind(struct thread_info *, char *);
 static void help(char *);
+static void pushdirs(struct dirjob *);
+static void searchdir(struct thread_info *, struct finder *, struct dirjob *);
+static void simulate(struct thread_info *, struct statfile **, size_t, char *);
+static void statdir(struct thread_info *, struct finder *, struct dirjob *);
+static void stats(struct thread_info *, struct finder *, int);
+static void *finder(void *);
 
 static struct option long_options[] = {
 	{ "dirs", no_argument, NULL, 'd' },
 	{ "files", no_argument, NULL, 'f' },
 	{ "name", no_argument, NULL, 'n' },
 	{ "xdev", no_argument, NULL, 'x' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "unordered", no_argument, NULL, 'u' },
+	{ "print0", no_argument, NULL, '0' },
+	{ "count", no_argument, NULL, 'c' },
+	{ "stats", no_argument, NULL, 's' },
 	{ "version", no_argument, NULL, 'V' },
 	{ "help", no_argument, NULL, 'h' },
 	{ 0, 0, 0, 0 }
 };
 
+static bool opt_count = false;
 static bool opt_dirs = false;
 static bool opt_files = false;
 static bool opt_names = false;
+static bool opt_stats = false;
+static bool opt_unordered = false;
 static bool opt_xdev = true;
+static char opt_term = '\n';
+static int opt_jobs = 0;
+
+static struct thread_info *findti;					/* shared, read-only */
+static dev_t topdev;								/* device of the current top directory */
+static int dirpending;								/* directories queued or being searched */
+static pthread_cond_t dircond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t dirlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t outlock = PTHREAD_MUTEX_INITIALIZER;
+static struct dirjob *dirstack;						/* directories to search */
 
 int main(int argc, char *argv[])
 {
@@ -43,12 +127,12 @@ int main(int argc, char *argv[])
 	int     c;
 	int     index = 0;
 	struct thread_info ti;							/* so we can use pcrecompile.c */
-	uint32_t pcrefind(struct thread_info *, bool, char *);
+	uint64_t entries = 0;							/* matches, all directories */
 
 	myname = base(argv[0]);
 
 	while(1) {
-		c = getopt_long(argc, argv, "dfnxVh?", long_options, &index);
+		c = getopt_long(argc, argv, "dfnxj:u0csVh?", long_options, &index);
 
 		if(c == -1)									/* end of options */
 			break;
@@ -71,6 +155,26 @@ int main(int argc, char *argv[])
 			opt_xdev = false;
 			break;
 
+		case 'j':									/* threads */
+			opt_jobs = atoi(optarg);
+			break;
+
+		case 'u':									/* print as found */
+			opt_unordered = true;
+			break;
+
+		case '0':									/* ala find -print0 */
+			opt_term = '\0';
+			break;
+
+		case 'c':									/* print the number of matches */
+			opt_count = true;
+			break;
+
+		case 's':									/* preview an INI section's removals */
+			opt_stats = true;
+			break;
+
 		case 'V':									/* print version */
 			fprintf(stdout, "%s: version %s\n", myname, VERSION_STRING);
 			exit(EXIT_SUCCESS);
@@ -89,17 +193,33 @@ int main(int argc, char *argv[])
 
 	memset(&ti, '\0', sizeof(struct thread_info));
 
-	ti.ti_section = myname;
-	ti.ti_pcrestr = argv[optind++];
+	if(opt_stats) {									/* <ini-file> <section> */
+		if(optind + 2 != argc) {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
 
-	if(IS_NULL(ti.ti_pcrestr)) {
-		help(argv[0]);
-		exit(EXIT_FAILURE);
-	}
+		if(!statsini(&ti, argv[optind], argv[optind + 1]))
+			exit(EXIT_FAILURE);
+	} else {
+		ti.ti_section = myname;
+		ti.ti_pcrestr = argv[optind++];
 
-	if(optind >= argc) {
-		help(argv[0]);
-		exit(EXIT_FAILURE);
+		if(IS_NULL(ti.ti_pcrestr)) {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+
+		if(optind >= argc) {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+
+		/* TODO: consider adding this as an option */
+		ti.ti_symlinks = false;
+
+		if(pcrecompile(&ti) == false)
+			exit(EXIT_FAILURE);
 	}
 
 	/* find everything if not given specifics */
@@ -107,25 +227,39 @@ int main(int argc, char *argv[])
 	if(!(opt_dirs || opt_files))
 		opt_dirs = opt_files = true;
 
-	/* TODO: consider adding this as an option */
-	ti.ti_symlinks = false;
+	if(opt_jobs <= 0 && (opt_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		opt_jobs = 1;
 
-	if(pcrecompile(&ti) == false)
-		exit(EXIT_FAILURE);
+	if(opt_jobs > MAXJOBS)
+		opt_jobs = MAXJOBS;
+
+	if(opt_stats) {
+		pcrefind(&ti, ti.ti_dirname);
+		exit(EXIT_SUCCESS);
+	}
 
 	while(optind < argc)
-		pcrefind(&ti, true, argv[optind++]);
+		entries += pcrefind(&ti, argv[optind++]);
+
+	if(opt_count)
+		fprintf(stdout, "%" PRIu64 "\n", entries);
 
 	exit(EXIT_SUCCESS);
 }
 
-uint32_t pcrefind(struct thread_info *ti, bool top, char *dir)
+static uint64_t pcrefind(struct thread_info *ti, char *dir)
 {
-	DIR    *dirp;
-	char    filename[PATH_MAX];						/* full pathname */
-	struct dirent *dp;
+	/* search one top directory with opt_jobs threads, then print */
+
+	int     i;
+	int     n;
+	pthread_t tids[MAXJOBS];
+	size_t  k;
+	size_t  noffs = 0;
+	struct dirjob *dj;
+	struct finder *fd;
 	struct stat stbuf;								/* file status */
-	uint32_t entries = 0;							/* file entries */
+	uint64_t entries = 0;							/* matches */
 
 	if(IS_NULL(dir))
 		return (0);
@@ -133,64 +267,712 @@ uint32_t pcrefind(struct thread_info *ti, bool top, char *dir)
 	if(*dir == '/' && *(dir + 1) == '/')			/* find started at / */
 		dir++;
 
-	if(top) {										/* reset */
-		if(stat(dir, &stbuf) == -1) {
-			fprintf(stderr, "%s: cannot stat: %s\n", ti->ti_section, dir);
-			return (0);
+	if(stat(dir, &stbuf) == -1) {
+		fprintf(stderr, "%s: cannot stat: %s\n", ti->ti_section, dir);
+		return (0);
+	}
+
+	topdev = stbuf.st_dev;							/* save mountpoint device */
+
+	if((fd = calloc(opt_jobs, sizeof(struct finder))) == NULL ||
+	   (dj = malloc(sizeof(struct dirjob) + strlen(dir) + 1)) == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", ti->ti_section);
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(dj->dj_path, dir);
+	dj->dj_next = NULL;
+	dirstack = dj;
+	dirpending = 1;
+
+	findti = ti;
+
+	for(n = 0; n < opt_jobs; n++)
+		if(pthread_create(&tids[n], NULL, &finder, &fd[n]) != 0) {
+			if(n == 0) {
+				fprintf(stderr, "%s: can't start threads\n", ti->ti_section);
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+		}
+
+	for(i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	for(i = 0; i < n; i++) {
+		entries += fd[i].fd_count;
+		noffs += fd[i].fd_noffs;
+	}
+
+	if(opt_stats)
+		stats(ti, fd, n);
+
+	/* sorted: one list of everything the threads found */
+
+	else if(!opt_unordered && !opt_count && noffs) {
+		char  **paths;
+
+		if((paths = malloc(noffs * sizeof(char *))) == NULL) {
+			fprintf(stderr, "%s: malloc failed\n", ti->ti_section);
+			exit(EXIT_FAILURE);
+		}
+
+		for(noffs = i = 0; i < n; i++)
+			for(k = 0; k < fd[i].fd_noffs; k++)
+				paths[noffs++] = fd[i].fd_buf + fd[i].fd_offs[k];
+
+		qsort(paths, noffs, sizeof(char *), cmppath);
+
+		for(k = 0; k < noffs; k++) {
+			fputs(paths[k], stdout);
+			putc(opt_term, stdout);
 		}
 
-		ti->ti_dev = stbuf.st_dev;					/* save mountpoint device */
+		fflush(stdout);
+		free(paths);
+	}
+
+	for(i = 0; i < n; i++) {
+		if(opt_unordered)
+			flushout(&fd[i]);
+
+		free(fd[i].fd_buf);
+		free(fd[i].fd_offs);
+		free(fd[i].fd_files);
 	}
 
+	free(fd);
+	return (entries);
+}
+
+static void *finder(void *arg)
+{
+	/* take directories until none are queued or being searched */
+
+	struct dirjob *dj;
+	struct finder *fd = arg;
+
+	if(opt_unordered && !opt_count && (fd->fd_buf = malloc(OUTBUFSIZ)) != NULL)
+		fd->fd_size = OUTBUFSIZ;
+
+	for(;;) {
+		pthread_mutex_lock(&dirlock);
+
+		while(dirstack == NULL && dirpending > 0)
+			pthread_cond_wait(&dircond, &dirlock);
+
+		if((dj = dirstack) == NULL) {
+			pthread_mutex_unlock(&dirlock);
+			break;
+		}
+
+		dirstack = dj->dj_next;
+		pthread_mutex_unlock(&dirlock);
+
+		if(opt_stats)
+			statdir(findti, fd, dj);
+		else
+			searchdir(findti, fd, dj);
+		free(dj);
+
+		pthread_mutex_lock(&dirlock);
+
+		if(--dirpending == 0)
+			pthread_cond_broadcast(&dircond);		/* done, wake the idle threads */
+
+		pthread_mutex_unlock(&dirlock);
+	}
+
+	return ((void *)0);
+}
+
+static void searchdir(struct thread_info *ti, struct finder *fd, struct dirjob *dj)
+{
+	DIR    *dirp;
+	bool    isdir;
+	char    filename[PATH_MAX];						/* full pathname */
+	char   *dir = dj->dj_path;
+	size_t  dirlen;
+	size_t  len;
+	struct dirent *dp;
+	struct dirjob *found = NULL;					/* subdirectories, pushed together */
+	struct dirjob *sub;
+	struct stat stbuf;								/* file status */
+
 	/* test the directory itself */
 
 	if(opt_dirs)
-		if(pcrematch(ti, opt_names ? base(dir) : dir)) {
-			fprintf(stdout, "%s\n", dir);
-			entries++;
-		}
+		if(pcrematch(ti, opt_names ? base(dir) : dir))
+			addpath(fd, dir, strlen(dir));
 
 	if((dirp = opendir(dir)) == NULL) {
 		fprintf(stderr, "%s: cannot open directory: %s: %s\n", ti->ti_section, dir,
 				strerror(errno));
 
-		return (entries);
+		return;
 	}
 
-	/* test the files */
+	dirlen = strlen(dir);
+	memcpy(filename, dir, dirlen);
+	filename[dirlen++] = '/';
+
+	/* test the files, d_type saves an lstat for most entries */
 
 	while((dp = readdir(dirp))) {
 		if(MY_DIR(dp->d_name) || MY_PARENT(dp->d_name))
 			continue;
 
-		if(snprintf(filename, PATH_MAX, "%s/%s", dir, dp->d_name) >= PATH_MAX) {
+		if((len = strlen(dp->d_name)) + dirlen >= PATH_MAX) {
 			fprintf(stderr, "%s: path too long: %s/%s\n", ti->ti_section, dir,
 					dp->d_name);
 			continue;
 		}
 
-		if(lstat(filename, &stbuf) == -1)
+		memcpy(filename + dirlen, dp->d_name, len + 1);
+		len += dirlen;
+
+		if(dp->d_type == DT_UNKNOWN || (dp->d_type == DT_DIR && !opt_xdev)) {
+			if(lstat(filename, &stbuf) == -1)
+				continue;
+
+			if(S_ISLNK(stbuf.st_mode) && !ti->ti_symlinks)
+				continue;
+
+			isdir = S_ISDIR(stbuf.st_mode);
+
+			if(isdir && stbuf.st_dev != topdev && !opt_xdev)
+				continue;
+		} else {
+			if(dp->d_type == DT_LNK && !ti->ti_symlinks)
+				continue;
+
+			isdir = dp->d_type == DT_DIR;
+		}
+
+		if(isdir) {
+			if((sub = newdir(filename, len, found)) != NULL)
+				found = sub;
 			continue;
+		}
+
+		if(opt_files)
+			if(pcrematch(ti, opt_names ? filename + dirlen : filename))
+				addpath(fd, filename, len);
+	}
+
+	closedir(dirp);
+
+	if(found)
+		pushdirs(found);
+}
+
+static void pushdirs(struct dirjob *found)
+{
+	/* one lock per directory searched */
+
+	int     n;
+	struct dirjob *last;
+
+	for(n = 1, last = found; last->dj_next; last = last->dj_next)
+		n++;
+
+	pthread_mutex_lock(&dirlock);
+	last->dj_next = dirstack;
+	dirstack = found;
+	dirpending += n;
+
+	if(n > 1)
+		pthread_cond_broadcast(&dircond);
+	else
+		pthread_cond_signal(&dircond);
+
+	pthread_mutex_unlock(&dirlock);
+}
+
+static bool addpath(struct finder *fd, char *path, size_t len)
+{
+	/* count, buffer for output, or keep for sorting */
+
+	size_t *offs;
+	size_t  size;
+
+	if(opt_count) {
+		fd->fd_count++;
+		return (true);
+	}
+
+	if(opt_unordered) {
+		if(fd->fd_buf == NULL) {					/* no buffer, lock per path */
+			pthread_mutex_lock(&outlock);
+			fwrite(path, 1, len, stdout);
+			putc(opt_term, stdout);
+			pthread_mutex_unlock(&outlock);
+			fd->fd_count++;
+			return (true);
+		}
+
+		if(fd->fd_len + len + 1 > fd->fd_size)
+			flushout(fd);
+
+		if(len + 1 > fd->fd_size)					/* can't happen, PATH_MAX */
+			return (false);
+	} else {
+		if(fd->fd_noffs == fd->fd_maxoffs) {
+			size = fd->fd_maxoffs ? fd->fd_maxoffs * 2 : 4096;
+
+			if((offs = realloc(fd->fd_offs, size * sizeof(size_t))) == NULL)
+				return (false);
+
+			fd->fd_offs = offs;
+			fd->fd_maxoffs = size;
+		}
+
+		if(!keeppath(fd, path, len, &fd->fd_offs[fd->fd_noffs]))
+			return (false);							/* counted only once kept */
+
+		fd->fd_noffs++;
+		fd->fd_count++;
+		return (true);
+	}
+
+	memcpy(fd->fd_buf + fd->fd_len, path, len);
+	fd->fd_buf[fd->fd_len + len] = opt_term;
+	fd->fd_len += len + 1;
+	fd->fd_count++;
+	return (true);
+}
+
+static bool flushout(struct finder *fd)
+{
+	/* whole buffers, so lines from different threads don't mix */
+
+	char   *p = fd->fd_buf;
+	ssize_t n;
+
+	pthread_mutex_lock(&outlock);
+	fflush(stdout);
+
+	while(fd->fd_len > 0) {
+		if((n = write(STDOUT_FILENO, p, fd->fd_len)) == -1) {
+			if(errno == EINTR)
+				continue;
+
+			fd->fd_len = 0;							/* EPIPE and the like, drop it */
+			break;
+		}
 
-		if(S_ISLNK(stbuf.st_mode) && !ti->ti_symlinks)
+		p += n;
+		fd->fd_len -= n;
+	}
+
+	pthread_mutex_unlock(&outlock);
+	return (true);
+}
+
+static struct dirjob *newdir(char *path, size_t len, struct dirjob *next)
+{
+	struct dirjob *dj;
+
+	if((dj = malloc(sizeof(struct dirjob) + len + 1)) == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", findti->ti_section);
+		return (NULL);
+	}
+
+	memcpy(dj->dj_path, path, len + 1);
+	dj->dj_next = next;
+	return (dj);
+}
+
+static bool keeppath(struct finder *fd, char *path, size_t len, size_t *off)
+{
+	/* NUL terminated in fd_buf, offsets survive realloc */
+
+	char   *buf;
+	size_t  size;
+
+	if(fd->fd_len + len + 1 > fd->fd_size) {
+		for(size = fd->fd_size ? fd->fd_size * 2 : OUTBUFSIZ; size < fd->fd_len + len + 1;)
+			size *= 2;
+
+		if((buf = realloc(fd->fd_buf, size)) == NULL)
+			return (false);
+
+		fd->fd_buf = buf;
+		fd->fd_size = size;
+	}
+
+	*off = fd->fd_len;
+	memcpy(fd->fd_buf + fd->fd_len, path, len);
+	fd->fd_buf[fd->fd_len + len] = '\0';
+	fd->fd_len += len + 1;
+	return (true);
+}
+
+static bool statsini(struct thread_info *ti, char *inifile, char *section)
+{
+	/* the keys readini() and startthreads() use for exp and dfs threads */
+
+	char    rpbuf[PATH_MAX];
+	char   *p;
+	ini_t  *inidata;								/* kept, ti points into it */
+
+	if((inidata = ini_load(inifile)) == NULL) {
+		fprintf(stderr, "%s: cannot load: %s\n", section, inifile);
+		return (false);
+	}
+
+	ti->ti_section = section;
+	p = my_ini(inidata, section, "dirname");
+
+	if(IS_NULL(p) || *p != '/' || realpath(p, rpbuf) == NULL || strcmp(rpbuf, "/") == 0) {
+		fprintf(stderr, "%s: missing or bad dirname: %s\n", section, p ? p : "");
+		return (false);
+	}
+
+	ti->ti_dirname = strdup(rpbuf);
+
+	p = my_ini(inidata, section, "subdirs");		/* defaults to true */
+	ti->ti_subdirs = IS_NULL(p) || strcmp(p, "1") == 0 || strcasecmp(p, "true") == 0;
+
+	p = my_ini(inidata, section, "symlinks");
+	ti->ti_symlinks = NOT_NULL(p) && (strcmp(p, "1") == 0 || strcasecmp(p, "true") == 0);
+
+	ti->ti_pcrestr = my_ini(inidata, section, "pcrestr");
+	ti->ti_dirlimstr = my_ini(inidata, section, "dirlimit");
+	ti->ti_dirlimit = logsize(ti->ti_dirlimstr);
+	ti->ti_expirestr = my_ini(inidata, section, "expiresiz");
+	ti->ti_expiresiz = logsize(ti->ti_expirestr);
+	ti->ti_diskfree = fabs(atof(my_ini(inidata, section, "diskfree") ? : "0"));
+	ti->ti_inofree = fabs(atof(my_ini(inidata, section, "inofree") ? : "0"));
+	ti->ti_expire = logretention(my_ini(inidata, section, "expire"));
+	ti->ti_retminstr = my_ini(inidata, section, "retmin");
+	ti->ti_retmin = logsize(ti->ti_retminstr);
+	ti->ti_retmaxstr = my_ini(inidata, section, "retmax");
+	ti->ti_retmax = logsize(ti->ti_retmaxstr);
+
+	if(ti->ti_retmax && ti->ti_retmax < ti->ti_retmin)
+		ti->ti_retmax = 0;							/* as sentinal does */
+
+	if(IS_NULL(ti->ti_pcrestr)) {
+		fprintf(stderr, "%s: pcrestr is not set\n", section);
+		return (false);
+	}
+
+	if(pcrecompile(ti) == false)
+		return (false);
+
+	if(!threadtype(ti, _EXP_THR) && !threadtype(ti, _DFS_THR)) {
+		fprintf(stderr, "%s: not an %s or %s section\n", section, _EXP_THR, _DFS_THR);
+		return (false);
+	}
+
+	return (true);
+}
+
+static void statdir(struct thread_info *ti, struct finder *fd, struct dirjob *dj)
+{
+	/* findfile()'s rules: regular files, matched by name, one filesystem */
+
+	DIR    *dirp;
+	char    filename[PATH_MAX];						/* full pathname */
+	char   *dir = dj->dj_path;
+	size_t  dirlen;
+	size_t  len;
+	size_t  rootlen = strlen(ti->ti_dirname);
+	struct dirent *dp;
+	struct dirjob *found = NULL;					/* subdirectories, pushed together */
+	struct dirjob *sub;
+	struct stat st;									/* file status */
+
+	if((dirp = opendir(dir)) == NULL) {
+		fprintf(stderr, "%s: cannot open directory: %s: %s\n", ti->ti_section, dir,
+				strerror(errno));
+
+		return;
+	}
+
+	dirlen = strlen(dir);
+	memcpy(filename, dir, dirlen);
+	filename[dirlen++] = '/';
+
+	while((dp = readdir(dirp))) {
+		if(MY_DIR(dp->d_name) || MY_PARENT(dp->d_name))
+			continue;
+
+		if((len = strlen(dp->d_name)) + dirlen >= PATH_MAX) {
+			fprintf(stderr, "%s: path too long: %s/%s\n", ti->ti_section, dir,
+					dp->d_name);
+			continue;
+		}
+
+		memcpy(filename + dirlen, dp->d_name, len + 1);
+		len += dirlen;
+
+		if(lstat(filename, &st) == -1)
 			continue;
 
-		if(S_ISDIR(stbuf.st_mode)) {
-			if(stbuf.st_dev == ti->ti_dev || opt_xdev)
-				entries += pcrefind(ti, false, filename);
+		if(S_ISLNK(st.st_mode)) {
+			if(!ti->ti_symlinks)
+				continue;
+
+			if(stat(filename, &st) == -1 || S_ISDIR(st.st_mode))
+				continue;							/* never follow symlinks to dirs */
+		}
 
+		if(st.st_dev != topdev)						/* never cross filesystems */
+			continue;
+
+		if(S_ISDIR(st.st_mode)) {
+			if(ti->ti_subdirs && (sub = newdir(filename, len, found)) != NULL)
+				found = sub;
 			continue;
 		}
 
-		if(opt_files)
-			if(pcrematch(ti, opt_names ? base(filename) : filename)) {
-				fprintf(stdout, "%s\n", filename);
-				entries++;
-			}
+		if(!S_ISREG(st.st_mode) || !namematch(ti, dp->d_name))
+			continue;
+
+		addfile(fd, filename + rootlen + 1, len - rootlen - 1,
+				dirlen > rootlen + 1 ? dirlen - rootlen - 2 : 0, &st);
 	}
 
 	closedir(dirp);
-	return (entries);
+
+	if(found)
+		pushdirs(found);
+}
+
+static bool addfile(struct finder *fd, char *path, size_t len, size_t dirlen, struct stat *st)
+{
+	struct statfile *sf;
+	size_t  size;
+
+	if(fd->fd_nfiles == fd->fd_maxfiles) {
+		size = fd->fd_maxfiles ? fd->fd_maxfiles * 2 : 4096;
+
+		if((sf = realloc(fd->fd_files, size * sizeof(struct statfile))) == NULL)
+			return (false);
+
+		fd->fd_files = sf;
+		fd->fd_maxfiles = size;
+	}
+
+	sf = &fd->fd_files[fd->fd_nfiles];
+
+	if(!keeppath(fd, path, len, &sf->sf_off))
+		return (false);
+
+	sf->sf_dirlen = dirlen;
+	sf->sf_size = st->st_size;
+	sf->sf_blocks = st->st_blocks;
+	sf->sf_mtime = st->st_mtim.tv_sec;
+	fd->fd_nfiles++;
+	fd->fd_count++;
+	return (true);
+}
+
+static void stats(struct thread_info *ti, struct finder *fd, int n)
+{
+	/* oldest first, as ORDER BY db_time */
+
+	char    tbuf[2][32];
+	int     i;
+	size_t  k;
+	size_t  nfiles = 0;
+	struct statfile **files;
+	unsigned long long bytes = 0;
+
+	for(i = 0; i < n; i++)
+		nfiles += fd[i].fd_nfiles;
+
+	fprintf(stdout, "%s: %s %s\n", ti->ti_section, ti->ti_dirname, ti->ti_pcrestr);
+
+	if(nfiles == 0) {
+		fprintf(stdout, "matched: 0 files\n");
+		return;
+	}
+
+	if((files = malloc(nfiles * sizeof(struct statfile *))) == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", ti->ti_section);
+		return;
+	}
+
+	for(nfiles = i = 0; i < n; i++)
+		for(k = 0; k < fd[i].fd_nfiles; k++) {
+			files[nfiles] = &fd[i].fd_files[k];
+			files[nfiles]->sf_path = fd[i].fd_buf + fd[i].fd_files[k].sf_off;
+			bytes += files[nfiles++]->sf_size;
+		}
+
+	qsort(files, nfiles, sizeof(struct statfile *), cmptime);
+
+	fprintf(stdout, "matched: %zu files, %llu bytes, oldest %s, newest %s\n", nfiles, bytes,
+			fmttime(files[0]->sf_mtime, tbuf[0]), fmttime(files[nfiles - 1]->sf_mtime, tbuf[1]));
+
+	if(threadtype(ti, _EXP_THR))
+		simulate(ti, files, nfiles, _EXP_THR);
+
+	if(threadtype(ti, _DFS_THR))
+		simulate(ti, files, nfiles, _DFS_THR);
+
+	free(files);
+}
+
+static void simulate(struct thread_info *ti, struct statfile **files, size_t nfiles, char *tname)
+{
+	/* one pass of the thread's decisions over every matching file */
+
+	bool    dfs = strcmp(tname, _DFS_THR) == 0;
+	char    ebuf[BUFSIZ];
+	char    tbuf[2][32];
+	char   *reason = NULL;
+	char   *reasons[] = { "retmax", "dirlimit", "expire", "remove" };
+	enum expaction act;
+	fsblkcnt_t bavail = 0;
+	fsfilcnt_t favail = 0;
+	size_t  dirfiles;
+	size_t  j;
+	size_t  k;
+	size_t  nrm = 0;
+	struct expstate es = { 0 };
+	struct statfile **rm;							/* removed, oldest first */
+	struct statvfs sv;
+	unsigned long long bytes = 0;
+	unsigned long long dirbytes;
+	unsigned long long rmbytes = 0;
+	uint64_t byreason[4] = { 0 };
+
+	for(k = 0; k < nfiles; k++)
+		bytes += files[k]->sf_size;
+
+	es.es_filecount = nfiles;
+	es.es_dirbytes = bytes;
+	time(&es.es_curtime);
+
+	if(dfs) {
+		if(statvfs(ti->ti_dirname, &sv) == -1 || sv.f_frsize == 0) {
+			fprintf(stderr, "%s: cannot stat: %s\n", ti->ti_section, ti->ti_dirname);
+			return;
+		}
+
+		bavail = sv.f_bavail;
+		favail = sv.f_favail;
+		fprintf(stdout, "%s: %.2f%% blocks free, %.2f%% inodes free, diskfree %.2f%%, inofree %.2f%%\n",
+				tname, percent(bavail, sv.f_blocks), percent(favail, sv.f_files),
+				ti->ti_diskfree, ti->ti_inofree);
+	} else
+		fprintf(stdout, "%s: expire %s, expiresiz %s, dirlimit %s, retmin %d, retmax %d\n",
+				tname, convexpire(ti->ti_expire, ebuf),
+				NOT_NULL(ti->ti_expirestr) ? ti->ti_expirestr : "0",
+				NOT_NULL(ti->ti_dirlimstr) ? ti->ti_dirlimstr : "0", ti->ti_retmin, ti->ti_retmax);
+
+	if((rm = malloc(nfiles * sizeof(struct statfile *))) == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", ti->ti_section);
+		return;
+	}
+
+	for(k = 0; k < nfiles; k++) {
+		if(dfs)
+			act = dfsdecide(ti, &es, percent(bavail, sv.f_blocks), percent(favail, sv.f_files),
+							&reason);
+		else
+			act = expdecide(ti, &es, files[k]->sf_size, files[k]->sf_mtime, &reason);
+
+		if(act == EXP_STOP)
+			break;
+
+		if(act == EXP_KEEP)
+			continue;
+
+		for(j = 0; j < 3 && strcmp(reason, reasons[j]); j++)
+			continue;
+
+		byreason[j]++;
+		rm[nrm++] = files[k];
+		rmbytes += files[k]->sf_size;
+		expremoved(ti, &es, files[k]->sf_size);
+
+		if(dfs) {
+			bavail += (fsblkcnt_t)files[k]->sf_blocks * 512 / sv.f_frsize;
+			favail++;
+		}
+	}
+
+	if(dfs && k == nfiles && dfsdecide(ti, &es, percent(bavail, sv.f_blocks),
+									   percent(favail, sv.f_files), &reason) == EXP_REMOVE)
+		fprintf(stdout, "%s: still low after removing every matching file\n", tname);
+	else if(dfs && reason)
+		fprintf(stdout, "%s: stops at retmin %d\n", tname, ti->ti_retmin);
+
+	if(nrm == 0)
+		fprintf(stdout, "remove:  0 files\n");
+	else {
+		fprintf(stdout, "remove:  %zu files, %llu bytes, oldest %s, newest %s\n", nrm, rmbytes,
+				fmttime(rm[0]->sf_mtime, tbuf[0]), fmttime(rm[nrm - 1]->sf_mtime, tbuf[1]));
+
+		if(!dfs)
+			fprintf(stdout, "         retmax %" PRIu64 ", dirlimit %" PRIu64 ", expire %" PRIu64 "\n",
+					byreason[0], byreason[1], byreason[2]);
+	}
+
+	fprintf(stdout, "retain:  %zu files, %llu bytes\n", nfiles - nrm, bytes - rmbytes);
+
+	/* removals by directory */
+
+	qsort(rm, nrm, sizeof(struct statfile *), cmpdir);
+
+	for(k = 0; k < nrm; k = j) {
+		dirfiles = 0;
+		dirbytes = 0;
+
+		for(j = k; j < nrm && cmpdir(&rm[k], &rm[j]) == 0; j++) {
+			dirfiles++;
+			dirbytes += rm[j]->sf_size;
+		}
+
+		fprintf(stdout, "  %10zu %15llu  %.*s\n", dirfiles, dirbytes,
+				rm[k]->sf_dirlen ? (int)rm[k]->sf_dirlen : 1,
+				rm[k]->sf_dirlen ? rm[k]->sf_path : ".");
+	}
+
+	free(rm);
+}
+
+static char *fmttime(time_t t, char *buf)
+{
+	struct tm tm;
+
+	strftime(buf, 32, "%F %T", localtime_r(&t, &tm));
+	return (buf);
+}
+
+static int cmptime(const void *a, const void *b)
+{
+	const struct statfile *x = *(struct statfile *const *)a;
+	const struct statfile *y = *(struct statfile *const *)b;
+
+	if(x->sf_mtime != y->sf_mtime)
+		return ((x->sf_mtime > y->sf_mtime) - (x->sf_mtime < y->sf_mtime));
+
+	return (strcmp(x->sf_path, y->sf_path));
+}
+
+static int cmpdir(const void *a, const void *b)
+{
+	const struct statfile *x = *(struct statfile *const *)a;
+	const struct statfile *y = *(struct statfile *const *)b;
+	int     rc;
+
+	if((rc = memcmp(x->sf_path, y->sf_path,
+					x->sf_dirlen < y->sf_dirlen ? x->sf_dirlen : y->sf_dirlen)) != 0)
+		return (rc);
+
+	return ((x->sf_dirlen > y->sf_dirlen) - (x->sf_dirlen < y->sf_dirlen));
+}
+
+static int cmppath(const void *a, const void *b)
+{
+	return (strcmp(*(char *const *)a, *(char *const *)b));
 }
 
 static void help(char *prog)
@@ -211,6 +993,21 @@ static void help(char *prog)
 	fprintf(stderr, "Do not cross filesystems (ala find dir -xdev):\n");
 	fprintf(stderr, "%s [ -x|--xdev ] <pcre> <dir> [ <dir> ... ]\n", p);
 	fprintf(stderr, "\n");
+	fprintf(stderr, "Search with N threads, default one per CPU:\n");
+	fprintf(stderr, "%s [ -j|--jobs N ] <pcre> <dir> [ <dir> ... ]\n", p);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Print matches as found, not sorted by directory:\n");
+	fprintf(stderr, "%s [ -u|--unordered ] <pcre> <dir> [ <dir> ... ]\n", p);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "End each match with NUL, not newline (ala find -print0):\n");
+	fprintf(stderr, "%s [ -0|--print0 ] <pcre> <dir> [ <dir> ... ]\n", p);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Print the number of matches only:\n");
+	fprintf(stderr, "%s [ -c|--count ] <pcre> <dir> [ <dir> ... ]\n", p);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Preview what an exp or dfs INI section would remove, remove nothing:\n");
+	fprintf(stderr, "%s -s|--stats <ini-file> <section>\n", p);
+	fprintf(stderr, "\n");
 	fprintf(stderr, "Print the program version, exit:\n");
 	fprintf(stderr, "%s -V|--version\n", p);
 	fprintf(stderr, "\n");
@@ -1,36 +1,193 @@
 /*
  * pcrematch.c
  * Run the pcre2_match function to test a string.
+ * pcrecompile()'s prefilter runs first and settles most names: literal
+ * patterns without pcre2 at all, others by rejecting names that lack
+ * the pattern's literal or required code units.
+ * Each thread keeps one match_data, match context and JIT stack, reused
+ * for every call.  Only the whole-match result is used, so one ovector
+ * pair serves any pattern.
  *
- * Copyright (c) 2021-2025 jjb
+ * Copyright (c) 2021-2026 jjb
  * All rights reserved.
  *
  * This source code is licensed under the MIT license found
  * in the root directory of this source tree.
  */
 
+#define	_GNU_SOURCE
+
 #include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sentinal.h"
 
+#define	JITSTACKMIN		(32 * 1024)					/* pcre2 default */
+#define	JITSTACKMAX		(16 * 1024 * 1024)			/* grown to on PCRE2_ERROR_JIT_STACKLIMIT */
+#define	JITFRAMES		256							/* frames to start with */
+
+struct pcrecache {
+	pcre2_match_data *pc_mdata;						/* one ovector pair */
+	pcre2_match_context *pc_mctx;					/* holds pc_stack */
+	pcre2_jit_stack *pc_stack;						/* JIT stack, NULL before first JIT match */
+	PCRE2_SIZE pc_stacksiz;							/* pc_stack maximum */
+};
+
+static pthread_key_t pcrekey;
+static pthread_once_t pcreonce = PTHREAD_ONCE_INIT;
+
+static int pcreprefilter(struct pcrefilter *, char *, size_t);
+static bool pcrestack(struct pcrecache *, PCRE2_SIZE);
+static struct pcrecache *pcrecache(void);
+static void pcrefree(void *);
+static void pcrekeyinit(void);
+
 bool pcrematch(struct thread_info *ti, char *s)
 {
 	int     rc;
-	pcre2_match_data *mdata;
+	size_t  framesize;
+	size_t  jitsize = 0;
+	size_t  len;
+	struct pcrecache *pc;
 	uint32_t options = 0;
 
-	/* mostly copied from namematch.c */
-
 	if(IS_NULL(s) || ti->ti_pcrecmp == NULL)
 		return (false);
 
-	mdata = pcre2_match_data_create_from_pattern(ti->ti_pcrecmp, NULL);
+	len = strlen(s);
 
-	rc = pcre2_match(ti->ti_pcrecmp, (PCRE2_SPTR) s, strlen(s), (PCRE2_SIZE) 0, options,
-					 mdata, NULL);
+	if((rc = pcreprefilter(&ti->ti_pcrefilter, s, len)) != 0)
+		return (rc > 0);
+
+	if((pc = pcrecache()) == NULL)
+		return (false);
+
+	/* JIT stack sized from the pattern's frame size, grown if too small */
+
+	if(pc->pc_stack == NULL &&
+	   pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_JITSIZE, &jitsize) == 0 && jitsize) {
+		if(pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_FRAMESIZE, &framesize) != 0)
+			framesize = 0;
+
+		pcrestack(pc, framesize * JITFRAMES);
+	}
+
+	for(;;) {
+		rc = pcre2_match(ti->ti_pcrecmp, (PCRE2_SPTR) s, len, (PCRE2_SIZE) 0, options,
+						 pc->pc_mdata, pc->pc_mctx);
+
+		if(rc != PCRE2_ERROR_JIT_STACKLIMIT || !pcrestack(pc, pc->pc_stacksiz * 2))
+			break;
+	}
 
-	pcre2_match_data_free(mdata);
 	return (rc >= 0);
 }
 
+static int pcreprefilter(struct pcrefilter *pf, char *s, size_t n)
+{
+	/* -1 no match, 1 match, 0 ask pcre2 -- $ also matches before a final newline */
+
+	char   *lit = pf->pf_lit;						/* shorthand */
+	size_t  len = pf->pf_len;
+
+	if(pf->pf_first != -1 && memchr(s, pf->pf_first, n) == NULL)
+		return (-1);
+
+	if(pf->pf_last != -1 && memchr(s, pf->pf_last, n) == NULL)
+		return (-1);
+
+	switch (len ? pf->pf_anchor : -1) {
+
+	case PF_EXACT:
+		if(n == len + 1 && s[len] == '\n')
+			n--;
+
+		return (n == len && memcmp(s, lit, len) == 0 ? 1 : -1);
+
+	case PF_START:
+		return (n >= len && memcmp(s, lit, len) == 0 ? 0 : -1);
+
+	case PF_END:
+		if(n >= len && memcmp(s + n - len, lit, len) == 0)
+			return (0);
+
+		return (n > len && s[n - 1] == '\n' && memcmp(s + n - 1 - len, lit, len) == 0 ? 0 : -1);
+
+	case 0:
+		return (memmem(s, n, lit, len) ? 0 : -1);
+	}
+
+	return (0);
+}
+
+static struct pcrecache *pcrecache(void)
+{
+	/* this thread's match data, created on first use */
+
+	struct pcrecache *pc;
+
+	pthread_once(&pcreonce, pcrekeyinit);
+
+	if((pc = pthread_getspecific(pcrekey)) != NULL)
+		return (pc);
+
+	if((pc = calloc(1, sizeof(struct pcrecache))) == NULL)
+		return (NULL);
+
+	pc->pc_mdata = pcre2_match_data_create(1, NULL);
+	pc->pc_mctx = pcre2_match_context_create(NULL);
+
+	if(pc->pc_mdata == NULL || pc->pc_mctx == NULL) {
+		pcrefree(pc);
+		return (NULL);
+	}
+
+	pthread_setspecific(pcrekey, pc);
+	return (pc);
+}
+
+static bool pcrestack(struct pcrecache *pc, PCRE2_SIZE size)
+{
+	/* replace the JIT stack, false at the limit */
+
+	pcre2_jit_stack *stack;
+
+	if(size < JITSTACKMIN)
+		size = JITSTACKMIN;
+
+	if(size > JITSTACKMAX || size <= pc->pc_stacksiz)
+		return (false);
+
+	if((stack = pcre2_jit_stack_create(JITSTACKMIN, size, NULL)) == NULL)
+		return (false);
+
+	if(pc->pc_stack)
+		pcre2_jit_stack_free(pc->pc_stack);
+
+	pc->pc_stack = stack;
+	pc->pc_stacksiz = size;
+	pcre2_jit_stack_assign(pc->pc_mctx, NULL, stack);
+	return (true);
+}
+
+static void pcrekeyinit(void)
+{
+	pthread_key_create(&pcrekey, pcrefree);
+}
+
+static void pcrefree(void *arg)
+{
+	/* thread exit */
+
+	struct pcrecache *pc = arg;
+
+	if(pc->pc_stack)
+		pcre2_jit_stack_free(pc->pc_stack);
+
+	pcre2_match_context_free(pc->pc_mctx);
+	pcre2_match_data_free(pc->pc_mdata);
+	free(pc);
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
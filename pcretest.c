@@ -6,7 +6,11 @@
  * If this executable is called "pcretest", be verbose,
  * else terse (just print matches)
  *
- * Copyright (c) 2021-2025 jjb
+ * Given "-" for the strings, subjects are read from stdin, one per
+ * line or NUL terminated with -0, all loaded before matching so the
+ * reported rate is pcrematch() alone.
+ *
+ * Copyright (c) 2021-2026 jjb
  * All rights reserved.
  *
  * This source code is licensed under the MIT license found
@@ -15,26 +19,69 @@
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "sentinal.h"
 #include "basename.h"
 
+static void batch(struct thread_info *, int, bool);
+static void usage(char *);
+
 int main(int argc, char *argv[])
 {
+	bool    count = false;							/* -c: counts only */
 	bool    match;
-	bool    pcrematch(struct thread_info *, char *);
 	char   *myname;
+	char   *p;
+	int     delim = '\n';							/* -0: NUL */
 	int     i;
+	int     n;										/* first non-option */
 	struct thread_info ti;							/* so we can use pcrecompile.c */
 
 	myname = base(argv[0]);
 
-	if(argc > 1 && strcmp(argv[1], "-V") == 0) {
-		fprintf(stdout, "%s: version %s\n", myname, VERSION_STRING);
-		exit(EXIT_SUCCESS);
+	/*
+	 * options end at "--" or at the first argument that isn't all option
+	 * letters, so a pcre may start with '-'; getopt() would reject it
+	 */
+
+	for(n = 1; n < argc && *argv[n] == '-' && argv[n][1]; n++) {
+		if(strcmp(argv[n], "--") == 0) {
+			n++;
+			break;
+		}
+
+		if(strspn(argv[n] + 1, "0cVh") != strlen(argv[n] + 1))
+			break;									/* the pcre */
+
+		for(p = argv[n] + 1; *p; p++)
+			switch (*p) {
+
+			case '0':
+				delim = '\0';
+				break;
+
+			case 'c':
+				count = true;
+				break;
+
+			case 'V':
+				fprintf(stdout, "%s: version %s\n", myname, VERSION_STRING);
+				exit(EXIT_SUCCESS);
+
+			default:
+				usage(myname);
+				exit(EXIT_FAILURE);
+			}
 	}
 
+	argc -= n - 1;									/* argv[1] is the pcre */
+	argv += n - 1;
+
 	if(argc < 3 || IS_NULL(argv[1])) {
-		fprintf(stderr, "Usage: %s <pcre> <string> [ <string> ... ]\n", myname);
+		usage(myname);
 		exit(EXIT_FAILURE);
 	}
 
@@ -47,6 +94,11 @@ int main(int argc, char *argv[])
 	if(pcrecompile(&ti) == false)
 		exit(EXIT_FAILURE);
 
+	if(argc == 3 && strcmp(argv[2], "-") == 0) {
+		batch(&ti, delim, count);
+		exit(EXIT_SUCCESS);
+	}
+
 	for(i = 2; i < argc; i++) {
 		match = pcrematch(&ti, argv[i]);
 
@@ -59,4 +111,94 @@ int main(int argc, char *argv[])
 	exit(EXIT_SUCCESS);
 }
 
+static void batch(struct thread_info *ti, int delim, bool count)
+{
+	bool   *matched;
+	char   *line = NULL;
+	char   *subjects = NULL;						/* NUL terminated, back to back */
+	char   *p;
+	double  secs;
+	size_t  len = 0;
+	size_t  nsub = 0;
+	size_t  i;
+	size_t  jitsize = 0;
+	size_t  matches = 0;
+	size_t  size = 0;
+	size_t  used = 0;
+	ssize_t n;
+	struct pcrefilter *pf = &ti->ti_pcrefilter;	/* shorthand */
+	struct timespec t0;
+	struct timespec t1;
+
+	/* load everything first */
+
+	while((n = getdelim(&line, &len, delim, stdin)) != -1) {
+		if(n > 0 && line[n - 1] == delim)
+			line[--n] = '\0';
+
+		if(used + n + 1 > size) {
+			for(size = size ? size * 2 : 1 << 20; used + n + 1 > size;)
+				size *= 2;
+
+			if((subjects = realloc(subjects, size)) == NULL) {
+				fprintf(stderr, "%s: realloc failed\n", ti->ti_section);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		memcpy(subjects + used, line, n + 1);
+		used += n + 1;
+		nsub++;
+	}
+
+	free(line);
+
+	if((matched = calloc(nsub ? nsub : 1, sizeof(bool))) == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", ti->ti_section);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for(p = subjects, i = 0; i < nsub; p += strlen(p) + 1, i++)
+		matches += matched[i] = pcrematch(ti, p);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if(!count)
+		for(p = subjects, i = 0; i < nsub; p += strlen(p) + 1, i++) {
+			if(!ti->ti_terse)
+				fprintf(stdout, "%s %s%c", matched[i] ? "match:   " : "no match:", p, delim);
+			else if(matched[i])
+				fprintf(stdout, "%s%c", p, delim);
+		}
+
+	/* counts to stdout with -c, else stderr so the output stays a list */
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	pcre2_pattern_info(ti->ti_pcrecmp, PCRE2_INFO_JITSIZE, &jitsize);
+
+	fprintf(count ? stdout : stderr, "%zu subjects, %zu match, %zu no match, "
+			"%.0f subjects/sec, %.0f matches/sec, jit %s, prefilter %s%.*s%s\n",
+			nsub, matches, nsub - matches, secs > 0 ? nsub / secs : 0.0,
+			secs > 0 ? matches / secs : 0.0, jitsize ? "yes" : "no",
+			pf->pf_len ? "\"" : "none", (int)pf->pf_len, pf->pf_lit,
+			pf->pf_len == 0 ? "" : pf->pf_anchor == PF_EXACT ? "\" exact" :
+			pf->pf_anchor == PF_START ? "\" prefix" : pf->pf_anchor == PF_END ? "\" suffix" : "\"");
+
+	free(matched);
+	free(subjects);
+}
+
+static void usage(char *myname)
+{
+	fprintf(stderr, "Usage: %s <pcre> <string> [ <string> ... ]\n", myname);
+	fprintf(stderr, "       %s [-0] [-c] <pcre> -\n", myname);
+	fprintf(stderr, "  -    read subjects from stdin, one per line\n");
+	fprintf(stderr, "  -0   subjects are NUL terminated, as from find -print0\n");
+	fprintf(stderr, "  -c   print counts and rates only\n");
+	fprintf(stderr, "  -V   print the program version, exit\n");
+	fprintf(stderr, "  --   end of options, for a pcre made of option letters\n");
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -15,10 +15,17 @@
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <pwd.h>
+#include <signal.h>
 #include <string.h>
 #include <unistd.h>
 #include "sentinal.h"
 
+#define	WAITSTEP	100000							/* timeout polling, usec */
+#define	KILLGRACE	5								/* SIGTERM to SIGKILL, seconds */
+
+static int postwait(struct thread_info *, pid_t, int *);
+
+extern int posttimeout;								/* postcmd run limit */
 extern struct utsname utsbuf;						/* for host info */
 
 static bool appendstr(char *dst, size_t dstsize, size_t *dstlen, const char *src)
@@ -119,6 +126,8 @@ int postcmd(struct thread_info *ti, char *filename)
 		return (-1);
 
 	case 0:
+		setpgid(0, 0);								/* timeouts signal the group */
+
 		if(droppriv(ti) == -1) {
 			fprintf(stderr, "%s: can't drop privileges\n", ti->ti_section);
 			exit(EXIT_FAILURE);
@@ -141,7 +150,7 @@ int postcmd(struct thread_info *ti, char *filename)
 
 		/* close parent's and unused fds */
 
-		for(i = 3; i < MAXFILES; i++)
+		for(i = 3; i < sysconf(_SC_OPEN_MAX); i++)	/* raised with the section count */
 			close(i);
 
 		/* execution environment */
@@ -159,7 +168,9 @@ int postcmd(struct thread_info *ti, char *filename)
 		exit(EXIT_FAILURE);
 
 	default:
-		if(waitpid(pid, &status, 0) == -1)
+		setpgid(pid, pid);							/* whichever runs first */
+
+		if(postwait(ti, pid, &status) == -1)
 			return (-1);
 
 		if(ti->ti_truncate && NOT_NULL(filename) && NOT_NULL(ti->ti_task)) {
@@ -176,4 +187,35 @@ int postcmd(struct thread_info *ti, char *filename)
 	}
 }
 
+static int postwait(struct thread_info *ti, pid_t pid, int *status)
+{
+	/* wait for postcmd, signal its process group if it overruns posttimeout */
+
+	int     sig = SIGTERM;
+	pid_t   ret;
+	unsigned long long limit;						/* usec until signal */
+	unsigned long long waited = 0;					/* usec */
+
+	if(posttimeout <= 0)
+		return (waitpid(pid, status, 0) == -1 ? -1 : 0);
+
+	limit = (unsigned long long)posttimeout * 1000000ULL;
+
+	while((ret = waitpid(pid, status, WNOHANG)) == 0) {
+		if(waited >= limit) {
+			fprintf(stderr, "%s: postcmd timeout, sending %s\n", ti->ti_section,
+					sig == SIGTERM ? "SIGTERM" : "SIGKILL");
+
+			kill(-pid, sig);
+			limit += KILLGRACE * 1000000ULL;
+			sig = SIGKILL;
+		}
+
+		usleep(WAITSTEP);
+		waited += WAITSTEP;
+	}
+
+	return (ret == -1 ? -1 : 0);
+}
+
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
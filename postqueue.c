@@ -0,0 +1,251 @@
+/*
+ * postqueue.c
+ * Bounded, concurrent postcmd executor.
+ * wrk and slm threads queue jobs and return to their work; a fixed pool
+ * of runner threads executes them.  Jobs for a section run one at a
+ * time, in the order they were queued.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sentinal.h"
+
+#define	POSTBACKOFF		(5 * 1000000ULL)			/* usec before a section's next job after a failure */
+
+struct postjob {
+	struct postjob *pj_next;						/* queue link */
+	struct thread_info *pj_ti;						/* section settings */
+	char    pj_filename[PATH_MAX];					/* full pathname */
+	uint64_t pj_queued;								/* monotime() at submit */
+};
+
+static bool postenqueue(struct thread_info *, char *, bool);
+static struct postjob *postnext(uint64_t, uint64_t *);
+static void *postrunner(void *);
+
+static pthread_cond_t postcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t postdone = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t postlock = PTHREAD_MUTEX_INITIALIZER;
+static struct postjob *posthead;					/* oldest job */
+static struct postjob *posttail;					/* newest job */
+static int postdepth;								/* jobs waiting to run */
+static int posthiwat;								/* reported queue depth */
+static int postrunning;								/* jobs running */
+
+bool postqueue_init(int runners)
+{
+	int     i;
+	pthread_condattr_t attr;
+	pthread_t tid;
+
+	/* runners wait out a back-off on the monotime() clock */
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&postcond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for(i = 0; i < runners; i++)
+		if(pthread_create(&tid, NULL, &postrunner, NULL) != 0) {
+			fprintf(stderr, "postcmd: can't start runner thread\n");
+			return (false);
+		}
+
+	return (true);
+}
+
+bool postqueue_submit(struct thread_info *ti, char *filename)
+{
+	return (postenqueue(ti, filename, false));
+}
+
+bool postqueue_once(struct thread_info *ti, char *filename)
+{
+	/* submit unless the section already has a job queued or running */
+
+	return (postenqueue(ti, filename, true));
+}
+
+static bool postenqueue(struct thread_info *ti, char *filename, bool once)
+{
+	struct postjob *pj;
+
+	if(IS_NULL(ti->ti_postcmd))
+		return (false);
+
+	if((pj = malloc(sizeof(struct postjob))) == NULL) {
+		fprintf(stderr, "%s: malloc failed\n", ti->ti_section);
+		return (false);
+	}
+
+	pj->pj_next = NULL;
+	pj->pj_ti = ti;
+	pj->pj_queued = monotime();
+	strlcpy(pj->pj_filename, NOT_NULL(filename) ? filename : "", PATH_MAX);
+
+	pthread_mutex_lock(&postlock);
+
+	if(once && ti->ti_postjobs > 0) {
+		pthread_mutex_unlock(&postlock);
+		free(pj);
+		return (false);
+	}
+
+	if(posttail)
+		posttail->pj_next = pj;
+	else
+		posthead = pj;
+
+	posttail = pj;
+	ti->ti_postjobs++;
+
+	/* report backlog growth, jobs waiting behind busy runners */
+
+	if(++postdepth > posthiwat && postdepth > 1) {
+		posthiwat = postdepth;
+		fprintf(stderr, "%s: postcmd queue depth %d\n", ti->ti_section, postdepth);
+	}
+
+	pthread_cond_signal(&postcond);
+	pthread_mutex_unlock(&postlock);
+	return (true);
+}
+
+int postqueue_depth(void)
+{
+	int     depth;
+
+	pthread_mutex_lock(&postlock);
+	depth = postdepth;
+	pthread_mutex_unlock(&postlock);
+	return (depth);
+}
+
+void postqueue_wait(struct thread_info *ti)
+{
+	/* a section's settings may be released once its jobs are done */
+
+	pthread_mutex_lock(&postlock);
+
+	while(ti->ti_postjobs > 0)
+		pthread_cond_wait(&postdone, &postlock);
+
+	pthread_mutex_unlock(&postlock);
+}
+
+static struct postjob *postnext(uint64_t now, uint64_t *wake)
+{
+	/*
+	 * oldest job whose section has nothing running and is not backing off,
+	 * keeps per-section order; *wake is the earliest back-off end, 0 = none
+	 */
+
+	struct postjob *pj;
+	struct postjob *prev = NULL;
+
+	*wake = 0;
+
+	for(pj = posthead; pj; prev = pj, pj = pj->pj_next) {
+		if(pj->pj_ti->ti_postbusy)
+			continue;
+
+		if(pj->pj_ti->ti_postafter > now) {
+			if(*wake == 0 || pj->pj_ti->ti_postafter < *wake)
+				*wake = pj->pj_ti->ti_postafter;
+
+			continue;
+		}
+
+		if(prev)
+			prev->pj_next = pj->pj_next;
+		else
+			posthead = pj->pj_next;
+
+		if(posttail == pj)
+			posttail = prev;
+
+		return (pj);
+	}
+
+	return (NULL);
+}
+
+static void *postrunner(void *arg)
+{
+	int     status;									/* postcmd child exit */
+	struct postjob *pj;
+	struct thread_info *ti;							/* thread settings */
+	struct timespec ts;								/* back-off end */
+	uint64_t start;									/* for metrics */
+	uint64_t wake;									/* from postnext */
+
+	(void)arg;
+	pthread_setname_np(pthread_self(), "sentinal_post");
+
+	for(;;) {
+		pthread_mutex_lock(&postlock);
+
+		while((pj = postnext(monotime(), &wake)) == NULL) {
+			if(wake == 0) {
+				pthread_cond_wait(&postcond, &postlock);
+				continue;
+			}
+
+			ts.tv_sec = wake / 1000000;
+			ts.tv_nsec = (wake % 1000000) * 1000;
+			pthread_cond_timedwait(&postcond, &postlock, &ts);
+		}
+
+		ti = pj->pj_ti;
+		ti->ti_postbusy = true;
+		postdepth--;
+		postrunning++;
+		pthread_mutex_unlock(&postlock);
+
+		start = monotime();
+		METRIC_ADD(ti, mt_postwait, start - pj->pj_queued);
+		status = postcmd(ti, pj->pj_filename);
+		METRIC_ADD(ti, mt_postcmds, 1);
+		METRIC_ADD(ti, mt_postusec, monotime() - start);
+
+		if(status != 0) {
+			METRIC_ADD(ti, mt_postfail, 1);
+			fprintf(stderr, "%s: postcmd exit: %d\n", ti->ti_section, status);
+		}
+
+		pthread_mutex_lock(&postlock);
+
+		if(status != 0)								/* be nice, without holding a runner */
+			ti->ti_postafter = monotime() + POSTBACKOFF;
+
+		ti->ti_postbusy = false;
+		ti->ti_postjobs--;
+		postrunning--;
+
+		if(postdepth == 0)
+			posthiwat = 0;							/* drained, report the next backlog */
+
+		pthread_cond_broadcast(&postcond);			/* the section's next job can run */
+		pthread_cond_broadcast(&postdone);			/* for postqueue_wait */
+		pthread_mutex_unlock(&postlock);
+		free(pj);
+	}
+
+	/* notreached */
+	return ((void *)0);
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
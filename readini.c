@@ -30,29 +30,35 @@
 static int parsecmd(char *, char **);
 static bool setiniflag(ini_t *, char *, char *);
 
-extern char database[PATH_MAX];						/* database file name */
-extern char *pidfile;								/* sentinal pid */
-extern char *sections[MAXSECT];						/* section names */
-extern ini_t *inidata;								/* loaded ini data */
-extern struct thread_info tinfo[MAXSECT];			/* our threads */
 extern struct utsname utsbuf;						/* for host info */
 
 char   *my_ini(ini_t *, char *, char *);
 
-int readini(char *myname, char *inifile)
+int readini(char *myname, char *inifile, struct iniglobal *ig, struct thread_info ***setp)
 {
+	/*
+	 * allocate *setp, the running threads' settings or a reload's
+	 * [global] goes to *ig, the caller decides what to apply
+	 */
+
 	char   *p;
 	char    inipath[PATH_MAX];						/* real path to file */
 	char    rpbuf[PATH_MAX];						/* real path buffer */
 	char    tbuf[PATH_MAX];							/* temp buffer */
+	char  **sections;								/* section names */
 	DIR    *dirp;
+	ini_t  *inidata;								/* loaded ini data */
 	int     i;
 	int     inifd;									/* file descriptor */
 	int     nsect;									/* number of sections found */
 	int     openflags = O_RDONLY;
 	struct stat stbuf;								/* file status */
+	struct thread_info **set;						/* one per section */
 	struct thread_info *ti;							/* thread settings */
-	int     get_sections(ini_t *, int, char **);
+	int     get_sections(ini_t *, char ***);
+
+	memset(ig, 0, sizeof(struct iniglobal));
+	ig->ig_postmax = POSTMAX;
 
 	if(lstat(inifile, &stbuf) == 0)
 		if(S_ISLNK(stbuf.st_mode)) {
@@ -93,13 +99,22 @@ int readini(char *myname, char *inifile)
 
 	/* configure the threads */
 
-	if((inidata = ini_load(inipath)) == NULL) {
+	if((ig->ig_inidata = inidata = ini_load(inipath)) == NULL) {
 		fprintf(stderr, "%s: can't load %s\n", myname, inipath);
 		return (0);
 	}
 
-	if((nsect = get_sections(inidata, MAXSECT, sections)) == 0) {
-		fprintf(stderr, "%s: nothing to do\n", myname);
+	if((nsect = get_sections(inidata, &ig->ig_sections)) <= 0) {
+		if(nsect == 0)
+			fprintf(stderr, "%s: nothing to do\n", myname);
+
+		return (0);
+	}
+
+	sections = ig->ig_sections;
+
+	if((*setp = set = calloc(nsect, sizeof(struct thread_info *))) == NULL) {
+		fprintf(stderr, "%s: calloc failed\n", myname);
 		return (0);
 	}
 
@@ -109,9 +124,9 @@ int readini(char *myname, char *inifile)
 	/* INI global settings */
 
 	p = my_ini(inidata, "global", "pidfile");
-	pidfile = IS_NULL(p) ? NULL : strndup(p, PATH_MAX);
+	ig->ig_pidfile = IS_NULL(p) ? NULL : strndup(p, PATH_MAX);
 
-	if(IS_NULL(pidfile) || *pidfile != '/') {
+	if(IS_NULL(ig->ig_pidfile) || *ig->ig_pidfile != '/') {
 		fprintf(stderr, "%s: pidfile is null or path not absolute\n", myname);
 		return (0);
 	}
@@ -119,17 +134,44 @@ int readini(char *myname, char *inifile)
 	p = my_ini(inidata, "global", "database");		/* optional */
 
 	if(IS_NULL(p) || strcmp(p, SQLMEMDB) == 0)
-		strlcpy(database, SQLMEMDB, PATH_MAX);
+		strlcpy(ig->ig_database, SQLMEMDB, PATH_MAX);
+	else
+		strlcpy(ig->ig_database, p, PATH_MAX);		/* verbatim */
+
+	p = my_ini(inidata, "global", "postmax");		/* optional */
+
+	if(NOT_NULL(p) && (ig->ig_postmax = abs(atoi(p))) == 0)
+		ig->ig_postmax = POSTMAX;
+
+	ig->ig_posttimeout = logretention(my_ini(inidata, "global", "posttimeout"));
+
+	p = my_ini(inidata, "global", "metrics");		/* optional */
+
+	if(NOT_NULL(p) && *p != '/')
+		fprintf(stderr, "%s: metrics path not absolute, ignored\n", myname);
+
+	strlcpy(ig->ig_metricsock, NOT_NULL(p) && *p == '/' ? p : "", PATH_MAX);
+
+	p = my_ini(inidata, "global", "sharedscan");	/* optional: true, fanout */
+
+	if(NOT_NULL(p) && strcasecmp(p, "fanout") == 0)
+		ig->ig_sharedscan = SHARE_FANOUT;
 	else
-		strlcpy(database, p, PATH_MAX);				/* verbatim */
+		ig->ig_sharedscan = setiniflag(inidata, "global", "sharedscan") ? SHARE_REGEXP : SHARE_OFF;
+
+	p = my_ini(inidata, "global", "pcrelib");		/* optional */
+	strlcpy(ig->ig_pcrelib, NOT_NULL(p) ? p : PCRELIB, PATH_MAX);
 
 	/* INI thread settings */
 
 	for(i = 0; i < nsect; i++) {
-		ti = &tinfo[i];								/* shorthand */
-		memset(ti, '\0', sizeof(struct thread_info));
+		if((ti = set[i] = calloc(1, sizeof(struct thread_info))) == NULL) {
+			fprintf(stderr, "%s: calloc failed\n", sections[i]);
+			return (0);
+		}
 
 		ti->ti_section = sections[i];
+		HUPRESET(ti);								/* later SIGHUPs are for this section */
 
 		p = my_ini(inidata, ti->ti_section, "command");
 		ti->ti_command = IS_NULL(p) ? NULL : strndup(p, PATH_MAX);
@@ -250,7 +292,8 @@ int readini(char *myname, char *inifile)
 
 			fullpath(rpbuf, base(ti->ti_pipename), tbuf);
 			ti->ti_pipename = strndup(tbuf, PATH_MAX);
-		}
+		} else
+			ti->ti_pipename = NULL;					/* not the INI data's "" */
 
 		ti->ti_template = malloc(BUFSIZ);			/* more than PATH_MAX */
 
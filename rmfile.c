@@ -10,6 +10,7 @@
  */
 
 #include <stdio.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,10 +19,29 @@
 bool rmfile(struct thread_info *ti, const char *obj, const char *remark)
 {
 	extern bool dryrun;
+	bool    isdir;									/* timed as rmdir */
+	int     ret = 0;								/* remove() */
+	struct stat stbuf;								/* for bytes freed */
+	uint64_t t;										/* remove() timing */
 
-	if(!dryrun && remove(obj) != 0) {
+	if(dryrun || lstat(obj, &stbuf) == -1)
+		stbuf.st_size = stbuf.st_mode = 0;
+
+	if((isdir = S_ISDIR(stbuf.st_mode)))
+		stbuf.st_size = 0;
+
+	if(!dryrun) {
+		t = monotime();
+		ret = remove(obj);
+		phase_add(ti, isdir ? PH_RMDIR : PH_UNLINK, monotime() - t);
+	}
+
+	if(ret != 0) {
 		int     errnum = errno;
 
+		if(errnum == ENOENT)						/* another section got there first */
+			return (false);
+
 		if(!ti->ti_terse)
 			fprintf(stderr, "%s: error %s %s: %s\n",
 					ti->ti_section, remark, obj, strerror(errnum));
@@ -33,6 +53,12 @@ bool rmfile(struct thread_info *ti, const char *obj, const char *remark)
 	if(!ti->ti_terse)
 		fprintf(stderr, "%s: %s %s\n", ti->ti_section, remark, obj);
 
+	if(!dryrun) {
+		METRIC_ADD(ti, mt_removed, 1);
+		METRIC_ADD(ti, mt_freed, stbuf.st_size);
+		scanstale(ti);								/* the next section walks again */
+	}
+
 	return (true);
 }
 
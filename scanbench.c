@@ -0,0 +1,418 @@
+/*
+ * scanbench.c
+ * Benchmark a findfile() + expfiles() cycle on a generated directory tree.
+ * The tree is reproducible from its parameters and seed.  Cycles run in
+ * dry-run mode against an in-memory database, so nothing is removed;
+ * dry run stops expfiles() after 10 candidates, so its time is mostly
+ * count_files() and the ORDER BY query.
+ *
+ * Filesystem calls made by findfile.o, sql.o and expthread.o are counted
+ * by wrapping them at link time, see BENCHWRAP in the Makefile.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ */
+
+#define	_GNU_SOURCE
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sentinal.h"
+#include "basename.h"
+#include "ini.h"
+
+#define	PCRESTR		"\\.log$"						/* default pattern */
+
+/* wrapped calls, counted */
+
+enum fscall { FC_OPENDIR, FC_READDIR, FC_CLOSEDIR, FC_LSTAT, FC_STAT, FC_OPEN, FC_REMOVE, NFSCALL };
+
+static char *fscallname[NFSCALL] = {
+	"opendir", "readdir", "closedir", "lstat", "stat", "open", "remove"
+};
+
+static uint64_t fscalls[NFSCALL];
+
+DIR    *__real_opendir(const char *);
+int     __real_closedir(DIR *);
+int     __real_lstat(const char *, struct stat *);
+int     __real_open(const char *, int, ...);
+int     __real_remove(const char *);
+int     __real_stat(const char *, struct stat *);
+struct dirent *__real_readdir(DIR *);
+
+DIR    *__wrap_opendir(const char *name)
+{
+	fscalls[FC_OPENDIR]++;
+	return (__real_opendir(name));
+}
+
+struct dirent *__wrap_readdir(DIR *dirp)
+{
+	fscalls[FC_READDIR]++;
+	return (__real_readdir(dirp));
+}
+
+int __wrap_closedir(DIR *dirp)
+{
+	fscalls[FC_CLOSEDIR]++;
+	return (__real_closedir(dirp));
+}
+
+int __wrap_lstat(const char *path, struct stat *st)
+{
+	fscalls[FC_LSTAT]++;
+	return (__real_lstat(path, st));
+}
+
+int __wrap_stat(const char *path, struct stat *st)
+{
+	fscalls[FC_STAT]++;
+	return (__real_stat(path, st));
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+	mode_t  mode = 0;
+	va_list ap;
+
+	if(flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	fscalls[FC_OPEN]++;
+	return (__real_open(path, flags, mode));
+}
+
+int __wrap_remove(const char *path)
+{
+	fscalls[FC_REMOVE]++;
+	return (__real_remove(path));
+}
+
+/* globals sentinal.c would provide */
+
+int     dryrun = true;								/* nothing is removed */
+int     ntinfo;										/* number of sections */
+int     postmax = POSTMAX;							/* concurrent postcmds */
+int     posttimeout = 0;							/* postcmd run limit */
+pthread_mutex_t dblock = PTHREAD_MUTEX_INITIALIZER;	/* sqlite lock */
+sqlite3 *db;										/* db handle */
+struct thread_info **tinfo;							/* our threads */
+struct utsname utsbuf;								/* for host info */
+volatile sig_atomic_t hupcount;						/* SIGHUPs received */
+volatile sig_atomic_t reload_requested;				/* SIGHUP */
+
+/* tree parameters */
+
+static char *prefixes[] = { "app", "access", "error", "audit", "trace", "db" };
+
+#define	NPREFIX		(sizeof(prefixes) / sizeof(prefixes[0]))
+
+static int depth = 2;								/* directory levels below the top */
+static int fanout = 8;								/* subdirectories per directory */
+static int nfiles = 200;							/* files per directory */
+static int matchpc = 50;							/* percent of names matching */
+static int spread = ONE_WEEK;						/* mtime spread, seconds */
+static uint64_t rng = 1;							/* xorshift state */
+static uint64_t ndirs;								/* generated */
+static uint64_t ntotal;								/* generated files */
+static uint64_t nmatch;								/* generated files matching */
+
+static struct option long_options[] = {
+	{ "depth", required_argument, NULL, 'd' },
+	{ "fanout", required_argument, NULL, 'f' },
+	{ "files", required_argument, NULL, 'n' },
+	{ "match", required_argument, NULL, 'm' },
+	{ "spread", required_argument, NULL, 's' },
+	{ "seed", required_argument, NULL, 'r' },
+	{ "iterations", required_argument, NULL, 'i' },
+	{ "tree", required_argument, NULL, 't' },
+	{ "keep", no_argument, NULL, 'k' },
+	{ "help", no_argument, NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+static bool maketree(char *, int, time_t);
+static int rmentry(const char *, const struct stat *, int, struct FTW *);
+static uint64_t xorshift(void);
+static void help(char *);
+
+int main(int argc, char *argv[])
+{
+	bool    keep = false;							/* leave the tree */
+	char   *myname;
+	char    tree[PATH_MAX] = "";					/* top of the tree */
+	int     c;
+	int     i;
+	int     index = 0;
+	int     iterations = 5;
+	struct phaseclock pc;							/* expfiles() timing */
+	struct phasesnap sn;							/* for the timing report */
+	struct thread_info ti;							/* an exp section */
+	uint32_t nextid = 1;							/* db_id, db_dirid */
+	uint32_t found;									/* findfile() entries */
+	uint64_t insert;								/* PH_INSERT usec, all cycles */
+	uint64_t calls[NFSCALL];						/* fs calls in the best cycle */
+	uint64_t best = UINT64_MAX;						/* fastest cycle, usec */
+	uint64_t bestwalk = 0;							/* its findfile() time */
+	uint64_t start;
+	uint64_t t1;
+	uint64_t t2;
+	uint64_t total = 0;								/* all cycles, usec */
+
+	myname = base(argv[0]);
+	setvbuf(stdout, NULL, _IOLBF, 0);				/* in order with stderr */
+
+	while((c = getopt_long(argc, argv, "d:f:n:m:s:r:i:t:kh?", long_options, &index)) != -1)
+		switch (c) {
+
+		case 'd':
+			depth = atoi(optarg);
+			break;
+
+		case 'f':
+			fanout = atoi(optarg);
+			break;
+
+		case 'n':
+			nfiles = atoi(optarg);
+			break;
+
+		case 'm':
+			matchpc = atoi(optarg);
+			break;
+
+		case 's':
+			spread = logretention(optarg);
+			break;
+
+		case 'r':
+			rng = strtoull(optarg, NULL, 0) | 1;	/* xorshift state must be nonzero */
+			break;
+
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+
+		case 't':
+			strlcpy(tree, optarg, PATH_MAX);
+			break;
+
+		case 'k':
+			keep = true;
+			break;
+
+		case 'h':
+		case '?':
+		default:
+			help(myname);
+			exit(EXIT_SUCCESS);
+		}
+
+	if(depth < 0 || fanout < 0 || nfiles < 0 || matchpc < 0 || matchpc > 100 ||
+	   spread < 1 || iterations < 1) {
+		help(myname);
+		exit(EXIT_FAILURE);
+	}
+
+	/* generate the tree */
+
+	if(*tree == '\0')
+		snprintf(tree, PATH_MAX, "/tmp/%s.XXXXXX", myname);
+
+	if(strstr(tree, "XXXXXX") ? mkdtemp(tree) == NULL : mkdir(tree, 0755) == -1) {
+		fprintf(stderr, "%s: can't create %s\n", myname, tree);
+		exit(EXIT_FAILURE);
+	}
+
+	start = monotime();
+
+	if(maketree(tree, depth, time(NULL)) == false) {
+		fprintf(stderr, "%s: can't generate the tree in %s\n", myname, tree);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "tree: %s depth %d fanout %d files/dir %d match %d%% spread %ds\n",
+			tree, depth, fanout, nfiles, matchpc, spread);
+	fprintf(stdout, "tree: %" PRIu64 " dirs %" PRIu64 " files %" PRIu64
+			" matching, generated in %.2fs\n", ndirs, ntotal, nmatch,
+			(monotime() - start) / 1e6);
+
+	/* an exp section over the tree, everything is expired */
+
+	memset(&ti, '\0', sizeof(ti));
+	ti.ti_section = "bench";
+	ti.ti_task = "bench_exp";
+	ti.ti_dirname = tree;
+	ti.ti_pcrestr = PCRESTR;
+	ti.ti_subdirs = true;
+	ti.ti_expire = 1;
+	ti.ti_terse = true;
+
+	if(pcrecompile(&ti) == false)
+		exit(EXIT_FAILURE);
+
+	if(sqlite3_open_v2(SQLMEMDB, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) !=
+	   SQLITE_OK || !schema_init(myname, db) || !create_table(&ti, db)) {
+		fprintf(stderr, "%s: can't open the database\n", myname);
+		exit(EXIT_FAILURE);
+	}
+
+	/* cycles, as expthread runs them */
+
+	phase_snap(&ti, &sn);
+
+	for(i = 0; i < iterations; i++) {
+		memset(fscalls, '\0', sizeof(fscalls));
+
+		start = monotime();
+		found = findfile(&ti, true, &nextid, tree, db);
+		t1 = monotime();
+
+		if(found > 0) {
+			phase_start(&pc);
+			expfiles(&ti, db);
+			phase_stop(&ti, PH_FILES, &pc);
+		}
+
+		t2 = monotime();
+
+		fprintf(stdout, "cycle %d: findfile %.3fms expfiles %.3fms, %u entries\n",
+				i + 1, (t1 - start) / 1e3, (t2 - t1) / 1e3, found);
+
+		total += t2 - start;
+
+		if(t2 - start < best) {
+			best = t2 - start;
+			bestwalk = t1 - start;
+			memcpy(calls, fscalls, sizeof(calls));
+		}
+	}
+
+	/* report */
+
+	fprintf(stdout, "best: %.3fms, %.0f files/sec (findfile %.0f files/sec)\n",
+			best / 1e3, ntotal * 1e6 / (best ? best : 1),
+			ntotal * 1e6 / (bestwalk ? bestwalk : 1));
+	fprintf(stdout, "mean: %.3fms, %.0f files/sec\n",
+			total / 1e3 / iterations, ntotal * 1e6 * iterations / (total ? total : 1));
+
+	insert = ti.ti_phase[PH_INSERT].ps_wall - sn.sn_wall[PH_INSERT];
+	fprintf(stdout, "insert: %.3fms per cycle, %.0f rows/sec\n", insert / 1e3 / iterations,
+			nmatch * 1e6 * iterations / (insert ? insert : 1));
+
+	fprintf(stdout, "fs calls per file:");
+
+	for(c = 0; c < NFSCALL; c++)
+		if(calls[c])
+			fprintf(stdout, " %s %.3f", fscallname[c], (double)calls[c] / (ntotal ? ntotal : 1));
+
+	fprintf(stdout, "\n");
+	fflush(stdout);
+
+	ti.ti_terse = false;
+	phase_report(&ti, &sn);							/* all cycles, on stderr */
+
+	if(!keep && nftw(tree, rmentry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+		fprintf(stderr, "%s: can't remove %s\n", myname, tree);
+
+	exit(EXIT_SUCCESS);
+}
+
+static uint64_t xorshift(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return (rng);
+}
+
+static bool maketree(char *dir, int level, time_t now)
+{
+	/* nfiles in dir, then fanout subdirectories while level > 0 */
+
+	bool    match;
+	char    path[PATH_MAX];
+	int     fd;
+	int     i;
+	struct timespec times[2];						/* atime, mtime */
+	uint64_t r;
+
+	ndirs++;
+
+	for(i = 0; i < nfiles; i++) {
+		r = xorshift();
+		match = (int)(r % 100) < matchpc;
+
+		snprintf(path, PATH_MAX, "%s/%s-%08" PRIx64 ".%s", dir,
+				 prefixes[(r >> 8) % NPREFIX], (r >> 16) & 0xffffffff, match ? "log" : "dat");
+
+		if((fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) == -1)
+			return (false);
+
+		close(fd);
+
+		times[0].tv_sec = times[1].tv_sec = now - (time_t)(xorshift() % spread);
+		times[0].tv_nsec = times[1].tv_nsec = 0;
+		utimensat(AT_FDCWD, path, times, 0);
+
+		ntotal++;
+		nmatch += match;
+	}
+
+	if(level == 0)
+		return (true);
+
+	for(i = 0; i < fanout; i++) {
+		snprintf(path, PATH_MAX, "%s/d%02d", dir, i);
+
+		if(mkdir(path, 0755) == -1 || maketree(path, level - 1, now) == false)
+			return (false);
+	}
+
+	return (true);
+}
+
+static int rmentry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+
+	return (__real_remove(path));
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, " -d, --depth N       directory levels below the top (2)\n");
+	fprintf(stderr, " -f, --fanout N      subdirectories per directory (8)\n");
+	fprintf(stderr, " -n, --files N       files per directory (200)\n");
+	fprintf(stderr, " -m, --match N       percent of names matching %s (50)\n", PCRESTR);
+	fprintf(stderr, " -s, --spread T      mtime spread, units = m, H, D, W (1W)\n");
+	fprintf(stderr, " -r, --seed N        tree seed (1)\n");
+	fprintf(stderr, " -i, --iterations N  cycles to time (5)\n");
+	fprintf(stderr, " -t, --tree DIR      generate here, must not exist (/tmp)\n");
+	fprintf(stderr, " -k, --keep          keep the tree\n");
+	fprintf(stderr, " -h, --help          this message\n");
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -0,0 +1,164 @@
+/*
+ * scangroup.c
+ * sharedscan: dfs and exp sections with the same dirname, subdirs and
+ * symlinks share one walk, in one of two ways:
+ *  - regexp: findfile() inserts every regular file into the group's
+ *    scanN tables, each section reads them through TEMP VIEWs that
+ *    match db_file with REGEXP from pcre2.so, see create_views()
+ *  - fanout: findfile() runs each section's namematch() and inserts
+ *    into each section's own tables, no extension needed
+ * A walk is reused by the other sections until it is SCANFRESH old,
+ * a section removes something, or a section joins.
+ *
+ * Copyright (c) 2021-2026 jjb
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found
+ * in the root directory of this source tree.
+ *
+ * Note: called with dblock held, like the rest of the sqlite work.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sentinal.h"
+
+static struct scangroup *groups;					/* every group so far */
+static int ngroups;									/* for sg_table names */
+
+struct scangroup *scangroup(struct thread_info *ti, bool fanout)
+{
+	/*
+	 * join the group walking ti's tree, start one if there is none
+	 * NULL if out of memory or the group is full, ti walks alone
+	 */
+
+	struct scangroup *sg;
+
+	for(sg = groups; sg; sg = sg->sg_next)
+		if(strcmp(sg->sg_dirname, ti->ti_dirname) == 0 && sg->sg_fanout == fanout &&
+		   sg->sg_subdirs == ti->ti_subdirs && sg->sg_symlinks == ti->ti_symlinks)
+			break;
+
+	if(sg == NULL) {
+		if((sg = calloc(1, sizeof(struct scangroup))) == NULL) {
+			fprintf(stderr, "%s: calloc failed\n", ti->ti_section);
+			return (NULL);
+		}
+
+		if((sg->sg_dirname = strdup(ti->ti_dirname)) == NULL) {	/* outlives ti */
+			fprintf(stderr, "%s: strdup failed\n", ti->ti_section);
+			free(sg);
+			return (NULL);
+		}
+
+		snprintf(sg->sg_table, sizeof(sg->sg_table), "scan%d", ++ngroups);
+		sg->sg_subdirs = ti->ti_subdirs;
+		sg->sg_symlinks = ti->ti_symlinks;
+		sg->sg_fanout = fanout;
+		sg->sg_next = groups;
+		groups = sg;
+	}
+
+	if(sg->sg_members == SCANMAX) {
+		fprintf(stderr, "%s: %d sections share %s, this one walks alone\n",
+				ti->ti_section, SCANMAX, ti->ti_dirname);
+
+		return (NULL);
+	}
+
+	sg->sg_ti[sg->sg_members++] = ti;
+	sg->sg_scanned = 0;								/* the last walk missed ti */
+	return (ti->ti_scangroup = sg);
+}
+
+void scanleave(struct thread_info *ti)
+{
+	/* the last section out drops the regexp tables */
+
+	int     i;
+	struct scangroup *sg = ti->ti_scangroup;		/* shorthand */
+	extern sqlite3 *db;								/* db handle */
+
+	if(sg == NULL)
+		return;
+
+	if(sg->sg_fanout) {
+		drop_table(ti, db);							/* its own */
+	} else {
+		drop_views(ti, db);
+
+		if(sg->sg_members == 1)
+			drop_table(ti, db);
+	}
+
+	for(i = 0; i < sg->sg_members; i++)
+		if(sg->sg_ti[i] == ti)
+			sg->sg_ti[i] = sg->sg_ti[--sg->sg_members];
+
+	if(sg->sg_members == 0)
+		sg->sg_scanned = 0;
+
+	ti->ti_scangroup = NULL;
+}
+
+char   *scantable(struct thread_info *ti)
+{
+	/* table name prefix findfile() fills for ti */
+
+	if(ti->ti_scangroup && !ti->ti_scangroup->sg_fanout)
+		return (ti->ti_scangroup->sg_table);
+
+	return (ti->ti_task);
+}
+
+bool scanfresh(struct thread_info *ti)
+{
+	struct scangroup *sg = ti->ti_scangroup;		/* shorthand */
+
+	return (sg && sg->sg_scanned && monotime() - sg->sg_scanned < SCANFRESH);
+}
+
+void scanbegin(struct thread_info *ti)
+{
+	/* a walk is about to drop and refill ti's tables, and its group's */
+
+	int     i;
+	struct scangroup *sg = ti->ti_scangroup;		/* shorthand */
+
+	ti->ti_walks++;
+
+	for(i = 0; sg && i < sg->sg_members; i++)
+		if(sg->sg_ti[i] != ti)
+			sg->sg_ti[i]->ti_walks++;
+}
+
+uint32_t scanwalks(struct thread_info *ti)
+{
+	/*
+	 * dblock is released between the pages of a dfs or exp pass, a walk
+	 * in between renumbers the dirids the keyset resumes at: the other
+	 * thread of a dfs and exp section, or another member of its group
+	 */
+
+	return (ti->ti_walks);
+}
+
+void scandone(struct thread_info *ti, uint32_t entries)
+{
+	if(ti->ti_scangroup) {
+		ti->ti_scangroup->sg_scanned = monotime();
+		ti->ti_scangroup->sg_entries = entries;
+	}
+}
+
+void scanstale(struct thread_info *ti)
+{
+	/* the tables no longer match the tree */
+
+	if(ti->ti_scangroup)
+		ti->ti_scangroup->sg_scanned = 0;
+}
+
+/* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
@@ -29,30 +29,58 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
+#include <string.h>
 #include <unistd.h>
 #include "sentinal.h"
 #include "basename.h"
 #include "ini.h"
+#include "namehash.h"
+
+#define	STARTSTEP	100000							/* usec between first exp scans */
+#define	STARTWINDOW	(10 * 1000000)					/* usec, last first exp scan */
 
 static bool create_pid_file(char *);
+static void freesection(struct thread_info *);
+static int fdneed(void);
 static void help(char *);
-static bool init_thread_database(struct thread_info *);
+static bool init_databases(struct thread_info **, int, bool *);
+static bool loadpcre(struct thread_info *);
+static void reload(char *, char *);
+static void reloadglobal(char *, struct iniglobal *);
+static bool samesection(struct thread_info *, struct thread_info *);
+static void stagger(struct thread_info **, int, bool *);
+static void startslm(char *);
+static bool startthreads(struct thread_info *);
+static void stopthread(char *, pthread_t, bool *, char *);
+static void stopthreads(struct thread_info *);
 static void threadwait(char *, pthread_t, bool *, char *, bool);
+static bool tunesection(struct thread_info *, struct thread_info *);
+static bool tunestr(char **, char *);
 
 static int debug = false;
 static int split = false;
 static int verbose = false;
 
+static bool slm_active = false;						/* pthread_t is opaque */
+static pthread_t slm_tid;							/* slm thread id */
+
 /* externals declared here */
 char    database[PATH_MAX];							/* database file name */
+char    metricsock[PATH_MAX];						/* metrics socket, empty = off */
+char    pcrelib[PATH_MAX];							/* pcre2.so for sharedscan */
 char   *pidfile;									/* sentinal pid */
-char   *sections[MAXSECT];							/* section names */
-ini_t  *inidata;									/* loaded ini data */
+enum sharemode sharedscan;							/* share walks of the same tree */
 int     dryrun = false;								/* dry run flag */
+int     ntinfo;										/* number of sections */
+int     postmax = POSTMAX;							/* concurrent postcmds */
+int     posttimeout = 0;							/* postcmd run limit, 0 = none */
 pthread_mutex_t dblock;								/* sqlite lock */
 sqlite3 *db;										/* db handle */
-struct thread_info tinfo[MAXSECT];					/* our threads */
+struct thread_info **tinfo;							/* our threads, one per section */
 struct utsname utsbuf;								/* for host info */
+volatile sig_atomic_t hupcount;						/* SIGHUPs received */
+volatile sig_atomic_t reload_requested;				/* SIGHUP: reread the INI file */
 
 static struct option long_options[] = {
 	{ "ini-file", required_argument, NULL, 'f' },
@@ -65,7 +93,7 @@ static struct option long_options[] = {
 	{ 0, 0, 0, 0 }
 };
 
-int     readini(char *, char *);
+int     readini(char *, char *, struct iniglobal *, struct thread_info ***);
 void    activethreads(struct thread_info *);
 void    debug_global(ini_t *, char *);
 void    debug_section(ini_t *, char *);
@@ -75,12 +103,14 @@ void    debug_verbose(struct thread_info *);
 int main(int argc, char *argv[])
 {
 	char    inifile[PATH_MAX];						/* ini file name */
+	bool    active;									/* some thread is running */
 	char   *myname;
 	int     c;
 	int     dbflags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
 	int     i;
 	int     index = 0;
 	int     nsect;									/* number of sections found */
+	struct iniglobal ig;							/* [global] settings */
 	struct thread_info *ti;							/* thread settings */
 
 	myname = base(argv[0]);
@@ -140,27 +170,35 @@ int main(int argc, char *argv[])
 
 	/* check the INI file for unsafe permissions */
 
-	if((nsect = readini(myname, inifile)) == 0) {
+	if((nsect = ntinfo = readini(myname, inifile, &ig, &tinfo)) == 0) {
 		/* nothing to do */
 		SLOWEXIT(EXIT_FAILURE);
 	}
 
+	pidfile = ig.ig_pidfile;
+	strlcpy(database, ig.ig_database, PATH_MAX);
+	strlcpy(metricsock, ig.ig_metricsock, PATH_MAX);
+	strlcpy(pcrelib, ig.ig_pcrelib, PATH_MAX);
+	sharedscan = ig.ig_sharedscan;
+	postmax = ig.ig_postmax;
+	posttimeout = ig.ig_posttimeout;
+
 	if(debug || split || verbose) {
 		/* in order of precedence */
 
-		debug_global(inidata, inifile);
+		debug_global(ig.ig_inidata, inifile);
 
 		if(split) {
 			for(i = 0; i < nsect; i++) {
-				ti = &tinfo[i];
-				debug_split(ti, inidata);
+				ti = tinfo[i];
+				debug_split(ti, ig.ig_inidata);
 			}
 		} else if(debug) {
 			for(i = 0; i < nsect; i++)
-				debug_section(inidata, sections[i]);
+				debug_section(ig.ig_inidata, ig.ig_sections[i]);
 		} else if(verbose) {
 			for(i = 0; i < nsect; i++) {
-				ti = &tinfo[i];
+				ti = tinfo[i];
 				debug_verbose(ti);
 				activethreads(ti);
 			}
@@ -181,7 +219,11 @@ int main(int argc, char *argv[])
 	}
 
 	parentsignals();								/* important: signal handling */
-	rlimit(MAXFILES);								/* limit the number of open files */
+
+	if(*metricsock && dryrun == false)				/* served from the main loop */
+		metrics_init(metricsock);
+
+	rlimit(MAXFILES + fdneed());					/* limit the number of open files */
 
 	/* version banner */
 
@@ -201,108 +243,430 @@ int main(int argc, char *argv[])
 	if(strcmp(database, SQLMEMDB) != 0)
 		chmod(database, 0600);
 
+	if(schema_init(myname, db) == false)			/* pragmas, older layouts */
+		exit(EXIT_FAILURE);
+
 	/* initialize thread locks */
 
 	pthread_mutex_init(&dblock, NULL);
 
+	/* wrk and slm threads queue their postcmds */
+
+	if(postqueue_init(postmax) == false)
+		exit(EXIT_FAILURE);
+
+	/* create every table up front, then start all threads at once */
+
+	if(init_databases(tinfo, nsect, NULL) == false)
+		exit(EXIT_FAILURE);
+
+	stagger(tinfo, nsect, NULL);
+
+	for(i = 0; i < nsect; i++)
+		if(startthreads(tinfo[i]) == false)
+			exit(EXIT_FAILURE);
+
+	startslm(myname);
+
 	/*
-	 * start threads
-	 * give them time to start and print their journal entries
+	 * wait for threads, report those that end
+	 * SIGHUP rotates wrk output and rereads the INI file
 	 */
 
-	for(i = 0; i < nsect; i++) {
-		ti = &tinfo[i];								/* shorthand */
+	for(active = true; active;) {
+		metrics_wait();								/* about a second */
 
-		if(threadtype(ti, _DFS_THR)) {				/* filesystem free space */
-			if(!ti->ti_retmin)
-				fprintf(stderr,
-						"%s: notice: recommend setting retmin in dfs threads\n",
-						ti->ti_section);
+		if(reload_requested) {
+			reload_requested = false;
+			reload(myname, inifile);
+		}
 
-			usleep((useconds_t) 400000);
+		for(i = 0; i < ntinfo; i++) {
+			ti = tinfo[i];							/* shorthand */
+			threadwait(ti->ti_section, ti->dfs_tid, &ti->dfs_active, _DFS_THR, false);
+			threadwait(ti->ti_section, ti->exp_tid, &ti->exp_active, _EXP_THR, false);
+			threadwait(ti->ti_section, ti->wrk_tid, &ti->wrk_active, _WRK_THR, false);
+		}
 
-			if(threadname(ti, _DFS_THR) == NULL || !init_thread_database(ti)) {
-				fprintf(stderr, "%s: can't initialize %s database\n",
-						ti->ti_section, _DFS_THR);
-				exit(EXIT_FAILURE);
-			}
+		threadwait(myname, slm_tid, &slm_active, _SLM_THR, false);
 
-			fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _DFS_THR,
-					ti->ti_dirname);
+		for(active = slm_active, i = 0; i < ntinfo; i++)
+			active |= tinfo[i]->dfs_active || tinfo[i]->exp_active || tinfo[i]->wrk_active;
+	}
 
-			ti->dfs_active = pthread_create(&ti->dfs_tid, NULL, &dfsthread, ti) == 0;
-		}
+	exit(EXIT_SUCCESS);
+}
 
-		if(threadtype(ti, _EXP_THR)) {				/* file expiration, retention, dirlimit */
-			if(ti->ti_expiresiz && !ti->ti_expire)
-				fprintf(stderr,
-						"%s: warning: expire size = %s, expire time = 0 (off) -- this is a noop\n",
-						ti->ti_section, ti->ti_expirestr);
+static bool startthreads(struct thread_info *ti)
+{
+	/* tables exist, see init_databases() */
 
-			if(ti->ti_retmax && ti->ti_retmax < ti->ti_retmin) {
-				fprintf(stderr,
-						"%s: warning: retmax is less than retmin -- setting retmax = 0\n",
-						ti->ti_section);
+	if(threadtype(ti, _DFS_THR)) {					/* filesystem free space */
+		if(!ti->ti_retmin)
+			fprintf(stderr,
+					"%s: notice: recommend setting retmin in dfs threads\n",
+					ti->ti_section);
 
-				ti->ti_retmax = 0;					/* don't lose anything */
-			}
+		fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _DFS_THR,
+				ti->ti_dirname);
 
-			usleep((useconds_t) 400000);
+		ti->dfs_active = pthread_create(&ti->dfs_tid, NULL, &dfsthread, ti) == 0;
+	}
 
-			if(threadname(ti, _EXP_THR) == NULL || !init_thread_database(ti)) {
-				fprintf(stderr, "%s: can't initialize %s database\n",
-						ti->ti_section, _EXP_THR);
-				exit(EXIT_FAILURE);
-			}
+	if(threadtype(ti, _EXP_THR)) {					/* file expiration, retention, dirlimit */
+		if(ti->ti_expiresiz && !ti->ti_expire)
+			fprintf(stderr,
+					"%s: warning: expire size = %s, expire time = 0 (off) -- this is a noop\n",
+					ti->ti_section, ti->ti_expirestr);
 
-			fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _EXP_THR,
-					ti->ti_dirname);
+		if(ti->ti_retmax && ti->ti_retmax < ti->ti_retmin) {
+			fprintf(stderr,
+					"%s: warning: retmax is less than retmin -- setting retmax = 0\n",
+					ti->ti_section);
 
-			ti->exp_active = pthread_create(&ti->exp_tid, NULL, &expthread, ti) == 0;
+			ti->ti_retmax = 0;						/* don't lose anything */
 		}
 
-		if(threadtype(ti, _SLM_THR)) {				/* simple log monitor */
-			usleep((useconds_t) 400000);
+		fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _EXP_THR,
+				ti->ti_dirname);
 
-			fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _SLM_THR,
-					ti->ti_dirname);
+		ti->exp_active = pthread_create(&ti->exp_tid, NULL, &expthread, ti) == 0;
+	}
 
-			ti->slm_active = pthread_create(&ti->slm_tid, NULL, &slmthread, ti) == 0;
-		}
+	if(threadtype(ti, _WRK_THR)) {					/* worker (log ingestion) thread */
+		fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _WRK_THR,
+				ti->ti_dirname);
+
+		ti->wrk_active = pthread_create(&ti->wrk_tid, NULL, &workthread, ti) == 0;
+	}
+
+	return (true);
+}
+
+static void startslm(char *myname)
+{
+	/* one simple log monitor thread serves every slm section */
+
+	int     i;
+	int     nslm = 0;								/* number of slm sections */
+
+	for(i = 0; i < ntinfo; i++)
+		if(threadtype(tinfo[i], _SLM_THR))
+			nslm++;
+
+	if(nslm == 0)
+		return;
+
+	fprintf(stderr, "%s: start %s thread: %d %s\n", myname, _SLM_THR,
+			nslm, nslm == 1 ? "section" : "sections");
+
+	slm_active = pthread_create(&slm_tid, NULL, &slmthread, NULL) == 0;
+}
+
+static void stopthread(char *section, pthread_t tid, bool *active, char *tname)
+{
+	/* threads act on the cancel at their next idle point */
+
+	if(*active)
+		pthread_cancel(tid);
+
+	threadwait(section, tid, active, tname, true);
+}
+
+static void stopthreads(struct thread_info *ti)
+{
+	stopthread(ti->ti_section, ti->dfs_tid, &ti->dfs_active, _DFS_THR);
+	stopthread(ti->ti_section, ti->exp_tid, &ti->exp_active, _EXP_THR);
+	stopthread(ti->ti_section, ti->wrk_tid, &ti->wrk_active, _WRK_THR);
+
+	postqueue_wait(ti);								/* queued postcmds use ti */
+
+	if(NOT_NULL(ti->ti_task) && (threadtype(ti, _DFS_THR) || threadtype(ti, _EXP_THR))) {
+		pthread_mutex_lock(&dblock);
+
+		if(ti->ti_scangroup)
+			scanleave(ti);
+		else
+			drop_table(ti, db);
+
+		pthread_mutex_unlock(&dblock);
+	}
+}
+
+#define	STRSAME(a,b)	((a) == (b) || ((a) && (b) && strcmp(a, b) == 0))
+
+static bool samesection(struct thread_info *old, struct thread_info *new)
+{
+	/* true if the threads can keep running with new thresholds */
+
+	char   *types[] = { _DFS_THR, _EXP_THR, _SLM_THR, _WRK_THR };
+	int     i;
+
+	for(i = 0; i < 4; i++)
+		if(threadtype(old, types[i]) != threadtype(new, types[i]))
+			return (false);
+
+	return (STRSAME(old->ti_command, new->ti_command) &&
+			STRSAME(old->ti_dirname, new->ti_dirname) &&
+			STRSAME(old->ti_pipename, new->ti_pipename) &&
+			STRSAME(old->ti_template, new->ti_template) &&
+			STRSAME(old->ti_pcrestr, new->ti_pcrestr) &&
+			old->ti_subdirs == new->ti_subdirs &&
+			old->ti_symlinks == new->ti_symlinks &&
+			old->ti_uid == new->ti_uid && old->ti_gid == new->ti_gid &&
+			old->ti_diskfree == new->ti_diskfree &&	/* dfs checks these at start */
+			old->ti_inofree == new->ti_inofree);
+}
+
+static bool tunesection(struct thread_info *old, struct thread_info *new)
+{
+	/*
+	 * threads read these on each pass, true if old now points into new's INI data
+	 * only changed strings move, old ones are not freed, a thread or postcmd
+	 * may be using them
+	 */
+
+	bool    ini = false;							/* took a string from new */
+
+	ini |= tunestr(&old->ti_dirlimstr, new->ti_dirlimstr);
+	old->ti_dirlimit = new->ti_dirlimit;
+	ini |= tunestr(&old->ti_rotatestr, new->ti_rotatestr);
+	old->ti_rotatesiz = new->ti_rotatesiz;
+	ini |= tunestr(&old->ti_expirestr, new->ti_expirestr);
+	old->ti_expiresiz = new->ti_expiresiz;
+	old->ti_expire = new->ti_expire;
+	ini |= tunestr(&old->ti_retminstr, new->ti_retminstr);
+	old->ti_retmin = new->ti_retmin;
+	ini |= tunestr(&old->ti_retmaxstr, new->ti_retmaxstr);
+	old->ti_retmax = new->ti_retmax;
+	old->ti_terse = new->ti_terse;
+	old->ti_rmdir = new->ti_rmdir;
+	old->ti_truncate = new->ti_truncate;
+
+	if(!STRSAME(old->ti_postcmd, new->ti_postcmd)) {
+		old->ti_postcmd = new->ti_postcmd;			/* its own buffer */
+		new->ti_postcmd = NULL;						/* not freed with new */
+	}
+
+	return (ini);
+}
+
+static bool tunestr(char **old, char *new)
+{
+	if(STRSAME(*old, new))
+		return (false);
+
+	*old = new;
+	return (true);
+}
+
+static void freesection(struct thread_info *ti)
+{
+	/*
+	 * what readini() and the threads allocated, once nothing runs for ti
+	 * the *str keys and ti_pcrestr point into the INI data, not freed here
+	 */
+
+	int     i;
+
+	for(i = 0; i < ti->ti_argc; i++)
+		free(ti->ti_argv[i]);
+
+	free(ti->ti_task);
+	free(ti->ti_section);
+	free(ti->ti_command);
+	free(ti->ti_path);
+	free(ti->ti_dirname);
+	free(ti->ti_mountdir);
+	free(ti->ti_pipename);
+	free(ti->ti_template);
+	free(ti->ti_filename);
+	free(ti->ti_postcmd);
+	pcre2_code_free(ti->ti_pcrecmp);
+	free(ti);
+}
+
+static void reloadglobal(char *myname, struct iniglobal *ig)
+{
+	/* posttimeout is read per postcmd, the others were used once at startup */
+
+	if(strcmp(ig->ig_pidfile, pidfile) != 0)
+		fprintf(stderr, "%s: reload: pidfile changed, needs a restart\n", myname);
+
+	if(strcmp(ig->ig_database, database) != 0 && !dryrun)
+		fprintf(stderr, "%s: reload: database changed, needs a restart\n", myname);
+
+	if(strcmp(ig->ig_metricsock, metricsock) != 0)
+		fprintf(stderr, "%s: reload: metrics changed, needs a restart\n", myname);
+
+	if(strcmp(ig->ig_pcrelib, pcrelib) != 0)
+		fprintf(stderr, "%s: reload: pcrelib changed, needs a restart\n", myname);
 
-		if(threadtype(ti, _WRK_THR)) {				/* worker (log ingestion) thread */
-			usleep((useconds_t) 400000);
+	if(ig->ig_sharedscan != sharedscan)
+		fprintf(stderr, "%s: reload: sharedscan changed, needs a restart\n", myname);
 
-			fprintf(stderr, "%s: start %s thread: %s\n", ti->ti_section, _WRK_THR,
-					ti->ti_dirname);
+	if(ig->ig_postmax != postmax)
+		fprintf(stderr, "%s: reload: postmax changed, needs a restart\n", myname);
 
-			ti->wrk_active = pthread_create(&ti->wrk_tid, NULL, &workthread, ti) == 0;
+	posttimeout = ig->ig_posttimeout;
+	free(ig->ig_pidfile);							/* the running one stays */
+}
+
+static void reload(char *myname, char *inifile)
+{
+	/*
+	 * diff a fresh readini() against the running sections by name
+	 *  - unchanged: keep running, apply thresholds in place
+	 *  - changed: stop and start with the new settings
+	 *  - removed: stop
+	 *  - new: start
+	 * of [global] only posttimeout applies, the rest need a restart
+	 */
+
+	bool    inikept = false;						/* a section uses the new INI data */
+	bool   *kept;									/* newinfo entry is running */
+	bool    slmchange = false;						/* restart the slm thread */
+	bool   *used;									/* newinfo entry matched */
+	int     i, j;
+	int    *match;									/* tinfo -> newinfo, -1 removed */
+	int     nsect;									/* number of sections found */
+	int     started = 0;
+	int     stopped = 0;
+	int     tuned = 0;
+	struct iniglobal ig;							/* reread [global] */
+	struct namehash byname;							/* newinfo section -> index */
+	struct thread_info **newinfo;					/* reread settings, the next tinfo */
+	struct thread_info *ti;							/* thread settings */
+
+	fprintf(stderr, "%s: reload %s\n", myname, inifile);
+
+	if((nsect = readini(myname, inifile, &ig, &newinfo)) == 0) {
+		fprintf(stderr, "%s: reload failed, keeping the running configuration\n", myname);
+		free(ig.ig_pidfile);
+		return;
+	}
+
+	kept = calloc(nsect, sizeof(bool));
+	used = calloc(nsect, sizeof(bool));
+	match = calloc(ntinfo, sizeof(int));
+
+	if(!kept || !used || !match || namehash_init(&byname, nsect) == false) {
+		fprintf(stderr, "%s: reload failed, out of memory\n", myname);
+
+		for(j = 0; j < nsect; j++)
+			freesection(newinfo[j]);
+
+		free(newinfo);
+		free(ig.ig_pidfile);
+		free(ig.ig_sections);
+		ini_free(ig.ig_inidata);
+		free(kept);
+		free(used);
+		free(match);
+		return;
+	}
+
+	reloadglobal(myname, &ig);
+
+	for(j = 0; j < nsect; j++)
+		namehash_add(&byname, newinfo[j]->ti_section, j);
+
+	for(i = 0; i < ntinfo; i++) {
+		ti = tinfo[i];								/* shorthand */
+
+		if((match[i] = namehash_find(&byname, ti->ti_section)) != -1)
+			used[match[i]] = true;
+
+		if(match[i] == -1 || !samesection(ti, newinfo[match[i]]))
+			slmchange |= threadtype(ti, _SLM_THR) ||
+				(match[i] != -1 && threadtype(newinfo[match[i]], _SLM_THR));
+	}
+
+	for(j = 0; j < nsect; j++)
+		if(!used[j])
+			slmchange |= threadtype(newinfo[j], _SLM_THR);
+
+	/* the slm thread holds pointers to its sections */
+
+	if(slmchange)
+		stopthread(myname, slm_tid, &slm_active, _SLM_THR);
+
+	/* newinfo becomes tinfo, in INI file order */
+
+	for(i = 0; i < ntinfo; i++) {
+		ti = tinfo[i];								/* shorthand */
+
+		if(match[i] != -1 && samesection(ti, newinfo[match[i]])) {
+			inikept |= tunesection(ti, newinfo[match[i]]);
+			freesection(newinfo[match[i]]);
+			newinfo[match[i]] = ti;					/* running threads keep ti */
+			kept[match[i]] = true;
+			tuned++;
+			continue;
 		}
+
+		fprintf(stderr, "%s: %s\n", ti->ti_section,
+				match[i] == -1 ? "removed" : "changed, restarting");
+
+		stopthreads(ti);
+		freesection(ti);							/* threads joined, postcmds drained */
+		stopped++;
 	}
 
-	/* wait for threads that ended early */
+	if(init_databases(newinfo, nsect, kept) == false)
+		fprintf(stderr, "%s: reload: can't initialize databases\n", myname);
+
+	stagger(newinfo, nsect, kept);
 
-	sleep(1);
+	for(j = 0; j < nsect; j++) {
+		if(kept[j])
+			continue;
 
-	for(i = 0; i < nsect; i++) {
-		ti = &tinfo[i];								/* shorthand */
-		threadwait(ti->ti_section, ti->dfs_tid, &ti->dfs_active, _DFS_THR, false);
-		threadwait(ti->ti_section, ti->exp_tid, &ti->exp_active, _EXP_THR, false);
-		threadwait(ti->ti_section, ti->slm_tid, &ti->slm_active, _SLM_THR, false);
-		threadwait(ti->ti_section, ti->wrk_tid, &ti->wrk_active, _WRK_THR, false);
+		if(!used[j])
+			fprintf(stderr, "%s: added\n", newinfo[j]->ti_section);
+
+		startthreads(newinfo[j]);					/* slm sections start below */
+		started++;
 	}
 
-	/* wait for threads */
+	free(tinfo);
+	tinfo = newinfo;
+	ntinfo = nsect;
+
+	rlimit(MAXFILES + fdneed());
+
+	if(slmchange)
+		startslm(myname);
 
-	for(i = 0; i < nsect; i++) {
-		ti = &tinfo[i];								/* shorthand */
-		threadwait(ti->ti_section, ti->dfs_tid, &ti->dfs_active, _DFS_THR, true);
-		threadwait(ti->ti_section, ti->exp_tid, &ti->exp_active, _EXP_THR, true);
-		threadwait(ti->ti_section, ti->slm_tid, &ti->slm_active, _SLM_THR, true);
-		threadwait(ti->ti_section, ti->wrk_tid, &ti->wrk_active, _WRK_THR, true);
+	if(started == 0 && !inikept)					/* a plain SIGHUP rotation */
+		ini_free(ig.ig_inidata);
+
+	free(ig.ig_sections);							/* the names went with the sections */
+	namehash_free(&byname);
+	free(kept);
+	free(match);
+	free(used);
+
+	fprintf(stderr, "%s: reload done: %d kept, %d stopped, %d started\n",
+			myname, tuned, stopped, started);
+}
+
+static int fdneed(void)
+{
+	/* descriptors held per section, beyond MAXFILES */
+
+	int     i;
+	int     n = 0;
+
+	for(i = 0; i < ntinfo; i++) {
+		if(threadtype(tinfo[i], _SLM_THR))
+			n++;									/* held for fstat */
+
+		if(threadtype(tinfo[i], _WRK_THR))
+			n += 4;									/* FIFO, holder, IPC pipe, spool */
 	}
 
-	exit(EXIT_SUCCESS);
+	return (n);
 }
 
 static bool create_pid_file(char *pidfile)
@@ -336,9 +700,121 @@ static bool create_pid_file(char *pidfile)
 	return (false);
 }
 
-static bool init_thread_database(struct thread_info *ti)
+static bool init_databases(struct thread_info **set, int n, bool *skip)
 {
-	return (create_table(ti, db) && create_index(ti, db));
+	/*
+	 * name and create the dfs and exp tables of every section in set
+	 * in one transaction, sections with skip[i] set already have theirs
+	 * with sharedscan a section joins its scan group, regexp groups
+	 * need pcre2.so and give each section views, else fanout
+	 */
+
+	bool    ok = true;
+	enum sharemode mode;							/* sharedscan, after loading pcre2.so */
+	static bool pcreloaded = false;
+	int     i;
+	struct thread_info *first = NULL;				/* for sqlexec messages */
+	struct thread_info *ti;							/* thread settings */
+
+	for(i = 0; i < n && first == NULL; i++)
+		if(!(skip && skip[i]) &&
+		   (threadtype(set[i], _DFS_THR) || threadtype(set[i], _EXP_THR)))
+			first = set[i];
+
+	if(first == NULL)								/* no scanning sections */
+		return (true);
+
+	pthread_mutex_lock(&dblock);
+
+	if(sharedscan == SHARE_REGEXP && !pcreloaded)	/* REGEXP for the views */
+		pcreloaded = loadpcre(first);
+
+	mode = sharedscan == SHARE_REGEXP && !pcreloaded ? SHARE_FANOUT : sharedscan;
+
+	if(sqlexec(first, db, "begin", "BEGIN;") == false) {
+		pthread_mutex_unlock(&dblock);
+		return (false);
+	}
+
+	for(i = 0; i < n && ok; i++) {
+		ti = set[i];								/* shorthand */
+
+		if(skip && skip[i])
+			continue;
+
+		if(threadtype(ti, _DFS_THR))
+			ok = threadname(ti, _DFS_THR) != NULL;
+
+		if(ok && threadtype(ti, _EXP_THR))
+			ok = threadname(ti, _EXP_THR) != NULL;
+
+		if(ok && mode != SHARE_OFF && (threadtype(ti, _DFS_THR) || threadtype(ti, _EXP_THR)))
+			scangroup(ti, mode == SHARE_FANOUT);	/* NULL: ti walks alone */
+
+		if(ok && (threadtype(ti, _DFS_THR) || threadtype(ti, _EXP_THR)))
+			ok = create_table(ti, db) && create_index(ti, db);
+
+		if(ok && ti->ti_scangroup && !ti->ti_scangroup->sg_fanout)
+			ok = create_views(ti, db);
+
+		if(!ok)
+			fprintf(stderr, "%s: can't initialize database\n", ti->ti_section);
+	}
+
+	if(ok)
+		ok = sqlexec(first, db, "commit", "COMMIT;");
+	else
+		sqlexec(first, db, "rollback", "ROLLBACK;");
+
+	pthread_mutex_unlock(&dblock);
+	return (ok);
+}
+
+static bool loadpcre(struct thread_info *ti)
+{
+	/* pcre2.so gives sqlite REGEXP, sharedscan is fanout without it */
+
+	char   *errmsg = NULL;
+
+	sqlite3_db_config(db, SQLITE_DBCONFIG_ENABLE_LOAD_EXTENSION, 1, NULL);
+
+	if(sqlite3_load_extension(db, pcrelib, NULL, &errmsg) != SQLITE_OK) {
+		fprintf(stderr, "%s: sharedscan fanout, can't load %s: %s\n", ti->ti_section,
+				pcrelib, errmsg ? errmsg : sqlite3_errmsg(db));
+
+		sqlite3_free(errmsg);
+		return (false);
+	}
+
+	sqlite3_db_config(db, SQLITE_DBCONFIG_ENABLE_LOAD_EXTENSION, 0, NULL);
+	return (true);
+}
+
+static void stagger(struct thread_info **set, int n, bool *skip)
+{
+	/*
+	 * spread the first exp scans evenly in INI file order
+	 * STARTSTEP apart, all within STARTWINDOW however many sections
+	 * dfs threads check free space right away
+	 */
+
+	int     i;
+	int     k = 0;
+	int     nexp = 0;								/* exp threads to start */
+	unsigned int step;								/* usec between first scans */
+
+	for(i = 0; i < n; i++)
+		if(!(skip && skip[i]) && threadtype(set[i], _EXP_THR))
+			nexp++;
+
+	if(nexp == 0)
+		return;
+
+	step = STARTWINDOW / nexp < STARTSTEP ? STARTWINDOW / nexp : STARTSTEP;
+
+	for(i = 0; i < n; i++)
+		if(!(skip && skip[i]) && threadtype(set[i], _EXP_THR))
+			set[i]->ti_firstscan = step * k++;
 }
 
 static void threadwait(char *section, pthread_t tid,
@@ -22,6 +22,10 @@
 # include <pthread.h>
 #endif
 
+#ifndef _SIGNAL_H
+# include <signal.h>
+#endif
+
 #ifndef SQLITE3_H
 # include <sqlite3.h>
 #endif
@@ -32,10 +36,11 @@
 #endif
 
 #define	MAXARGS		32
-#define	MAXSECT		32								/* arbitrary, can be more */
 
 #define	MAXFILES	128								/* max open files */
 
+#define	POSTMAX		4								/* default concurrent postcmds */
+
 #ifndef PATH_MAX
 # define	PATH_MAX	255
 #endif
@@ -52,6 +57,7 @@
 #define	ONE_YEAR	(ONE_DAY * 365)					/* Y or y */
 
 #define	FIFOSIZ		(64 << 20)						/* 64MiB, better size for I/O */
+#define	SPOOLEXT	".spool"						/* sentinalpipe --drain spool suffix */
 
 #define	NOT_NULL(s)	((s) && *(s))
 #define	IS_NULL(s)	!((s) && *(s))
@@ -82,14 +88,161 @@
 #define	BASH		"/bin/bash"
 #define	PATH		"/usr/bin:/usr/sbin:/bin"
 
+/* SIGHUP: the handler counts, each thread compares with its last reset */
+
+extern volatile sig_atomic_t hupcount;				/* SIGHUPs received */
+
+#define	HUPPED(ti)		((ti)->ti_hupseen != hupcount)
+#define	HUPRESET(ti)	((ti)->ti_hupseen = hupcount)
+
+/* metrics: section threads update counters without locks, see metrics.c */
+
+#define	METRIC_ADD(ti,m,n)	__atomic_add_fetch(&(ti)->ti_metrics.m, (uint64_t)(n), __ATOMIC_RELAXED)
+#define	METRIC_SET(ti,m,n)	__atomic_store_n(&(ti)->ti_metrics.m, (uint64_t)(n), __ATOMIC_RELAXED)
+
+struct metrics {
+	uint64_t mt_scans;								/* findfile scans */
+	uint64_t mt_scanusec;							/* total scan time */
+	uint64_t mt_lastscan;							/* latest scan time, usec */
+	uint64_t mt_seen;								/* directory entries seen */
+	uint64_t mt_matched;							/* files matching pcrestr, not with regexp sharedscan */
+	uint64_t mt_removed;							/* files and dirs removed */
+	uint64_t mt_freed;								/* bytes removed */
+	uint64_t mt_bfree;								/* blocks free, 1/100 percent */
+	uint64_t mt_ffree;								/* inodes free, 1/100 percent */
+	uint64_t mt_wrkbytes;							/* bytes read from the FIFO */
+	uint64_t mt_rotations;							/* wrk files closed, slm files queued */
+	uint64_t mt_postcmds;							/* postcmds run */
+	uint64_t mt_postfail;							/* postcmds with nonzero exit */
+	uint64_t mt_postusec;							/* postcmd run time */
+	uint64_t mt_postwait;							/* postcmd queue time, usec */
+	uint64_t mt_lockwaits;							/* dblock acquisitions */
+	uint64_t mt_lockusec;							/* dblock wait time */
+};
+
+/* cheap checks run before pcre2_match, see pcrecompile.c */
+
+#define	PCRELITMAX	64								/* longest literal kept */
+
+#define	PF_START	0x01							/* pf_lit is a prefix */
+#define	PF_END		0x02							/* pf_lit is a suffix */
+#define	PF_EXACT	(PF_START | PF_END)				/* pf_lit is the whole pattern */
+
+struct pcrefilter {
+	char    pf_lit[PCRELITMAX];						/* literal every match contains */
+	size_t  pf_len;									/* 0, no literal */
+	int     pf_anchor;								/* PF_ flags */
+	int     pf_first;								/* first code unit, -1 none */
+	int     pf_last;								/* required code unit, -1 none */
+};
+
+/* sharedscan: sections walking the same tree share its tables, see scangroup.c */
+
+#define	PCRELIB		"/usr/lib/sqlite3/pcre2.so"		/* default pcrelib */
+#define	SCANFRESH	(ONE_MINUTE * 1000000ULL)		/* usec a shared walk is reused */
+#define	SCANMAX		16								/* sections in a scan group */
+
+enum sharemode { SHARE_OFF, SHARE_REGEXP, SHARE_FANOUT };
+
+/* INI [global] settings, readini() fills one per load, a reload applies posttimeout */
+
+struct iniglobal {
+	char   *ig_pidfile;								/* sentinal pid */
+	char    ig_database[PATH_MAX];					/* database file name */
+	char    ig_metricsock[PATH_MAX];				/* metrics socket, empty = off */
+	char    ig_pcrelib[PATH_MAX];					/* pcre2.so for sharedscan */
+	enum sharemode ig_sharedscan;					/* share walks of the same tree */
+	int     ig_postmax;								/* concurrent postcmds */
+	int     ig_posttimeout;							/* postcmd run limit, 0 = none */
+	char  **ig_sections;							/* section names */
+	struct ini_t *ig_inidata;						/* loaded ini data, sections point into it */
+};
+
+struct scangroup {
+	struct scangroup *sg_next;						/* all groups, never freed */
+	char    sg_table[TASK_COMM_LEN];				/* scanN, used like ti_task */
+	char   *sg_dirname;								/* key: dirname, subdirs, symlinks, mode */
+	bool    sg_subdirs;
+	bool    sg_symlinks;
+	bool    sg_fanout;								/* walk fills each member's own tables */
+	int     sg_members;								/* sections in sg_ti */
+	struct thread_info *sg_ti[SCANMAX];				/* the sections sharing the walk */
+	uint64_t sg_scanned;							/* monotime() of the last walk, 0 = stale */
+	uint32_t sg_entries;							/* findfile() result of that walk */
+};
+
+/*
+ * aggregates of a section's tables, kept by findfile() as it inserts
+ * so the exp and dfs passes need no COUNT(*) or SUM() scan, see sql.c
+ * not kept for regexp sharedscan, the views match in SQL
+ */
+
+struct tablestats {
+	bool    ts_valid;								/* false = ask sqlite */
+	uint32_t ts_files;								/* _file rows */
+	uint32_t ts_emptydirs;							/* _dir rows with db_empty */
+	unsigned long long ts_bytes;					/* SUM(db_size) */
+	time_t  ts_oldest;								/* MIN(db_time), a lower bound after removals */
+};
+
+/* retention decisions, see expdecide.c */
+
+#define	PADDING		0.295f							/* subtract from avail for extra space, reduce flapping */
+
+enum expaction { EXP_STOP, EXP_KEEP, EXP_REMOVE };
+
+struct expstate {
+	uint32_t es_filecount;							/* matching files left */
+	unsigned long long es_dirbytes;					/* their bytes, for dirlimit */
+	time_t  es_curtime;								/* now */
+};
+
+static inline bool LOW_RES(float target, float avail)
+{
+	return target > 0 && avail < target;
+}
+
+static inline double percent(double x, double y)
+{
+	return (y != 0.0) ? (x / y) * 100.0 : 0.0;
+}
+
+/* phases timed for latency histograms, see metrics.c */
+
+enum phase {
+	PH_READDIR, PH_STAT, PH_INSERT, PH_QUERY, PH_UNLINK, PH_RMDIR,	/* per call */
+	PH_WALK, PH_INDEX, PH_FILES, PH_DIRS,		/* per cycle, with CPU time */
+	NPHASE
+};
+
+#define	PH_BUCKETS	24								/* log2 usec buckets, last is +Inf */
+#define	PH_CYCLE(ph)	((ph) >= PH_WALK)
+
+struct phasestat {
+	uint64_t ps_count;								/* samples */
+	uint64_t ps_wall;								/* total wall-clock usec */
+	uint64_t ps_cpu;								/* total thread CPU usec, cycles only */
+	uint64_t ps_hist[PH_BUCKETS];					/* wall-clock */
+	uint64_t ps_cpuhist[PH_BUCKETS];				/* thread CPU, cycles only */
+};
+
+struct phaseclock {
+	uint64_t pc_wall;								/* monotime() at start */
+	uint64_t pc_cpu;								/* cputime() at start */
+};
+
+struct phasesnap {
+	uint64_t sn_count[NPHASE];						/* ps_count at cycle start */
+	uint64_t sn_wall[NPHASE];						/* ps_wall at cycle start */
+	uint64_t sn_cpu[NPHASE];						/* ps_cpu at cycle start */
+};
+
 struct thread_info {
 	pthread_t dfs_tid;								/* dfs thread id */
 	pthread_t exp_tid;								/* exp thread id */
-	pthread_t slm_tid;								/* slm thread id */
 	pthread_t wrk_tid;								/* wrk thread id */
 	bool    dfs_active;								/* pthread_t is opaque */
 	bool    exp_active;								/* pthread_t is opaque */
-	bool    slm_active;								/* pthread_t is opaque */
 	bool    wrk_active;								/* pthread_t is opaque */
 	char   *ti_task;								/* pthread_self */
 	char   *ti_section;								/* section name */
@@ -107,12 +260,17 @@ struct thread_info {
 	char   *ti_template;							/* file template */
 	char   *ti_pcrestr;								/* pcre for file match */
 	pcre2_code *ti_pcrecmp;							/* compiled pcre */
+	struct pcrefilter ti_pcrefilter;				/* rejects names before pcre2 */
+	struct scangroup *ti_scangroup;					/* sharedscan tables, NULL = own */
+	struct tablestats ti_stats;						/* as of the last walk */
+	uint32_t ti_walks;								/* walks of ti's tables, see scanwalks() */
 	char   *ti_filename;							/* output file name */
 	pid_t   ti_pid;									/* thread pid */
 	uid_t   ti_uid;									/* thread uid */
 	gid_t   ti_gid;									/* thread gid */
 	int     ti_wfd;									/* worker stdin or EOF */
-	int     ti_sig;									/* signal number received */
+	int     ti_hupseen;								/* hupcount at last rotate */
+	unsigned int ti_firstscan;						/* usec before the first exp scan */
 	char   *ti_rotatestr;							/* logfile rotate size string */
 	off_t   ti_rotatesiz;							/* logfile rotate size */
 	char   *ti_expirestr;							/* logfile expire size string */
@@ -128,52 +286,92 @@ struct thread_info {
 	bool    ti_rmdir;								/* remove empty dirs */
 	bool    ti_symlinks;							/* follow symlinks */
 	char   *ti_postcmd;								/* command to run after log closes */
+	int     ti_postjobs;							/* postcmd jobs queued or running */
+	bool    ti_postbusy;							/* postcmd job running */
+	uint64_t ti_postafter;							/* monotime() a failed postcmd backs off to */
 	bool    ti_truncate;							/* truncate slm-managed files */
+	struct metrics ti_metrics;						/* counters, kept across reloads */
+	struct phasestat ti_phase[NPHASE];				/* histograms, kept across reloads */
 };
 
+bool    exppending(struct thread_info *, struct expstate *);
+bool    metrics_init(char *);
 bool    namematch(struct thread_info *, char *);
 bool    pcrecompile(struct thread_info *);
 bool    pcrematch(struct thread_info *, char *);
+bool    postqueue_init(int);
+bool    postqueue_once(struct thread_info *, char *);
+bool    postqueue_submit(struct thread_info *, char *);
 bool    rmfile(struct thread_info *, const char *, const char *);
+bool    scanfresh(struct thread_info *);
 bool    threadtype(struct thread_info *, char *);
 bool    validdbname(char *);
 char   *convexpire(int, char *);
 char   *findmnt(char *, char *);
 char   *fullpath(const char *, const char *, char *);
 char   *logname(char *, char *);
+char   *scantable(struct thread_info *);
 char   *threadname(struct thread_info *, char *);
+enum expaction dfsdecide(struct thread_info *, struct expstate *, float, float, char **);
+enum expaction expdecide(struct thread_info *, struct expstate *, off_t, time_t, char **);
 gid_t   verifygid(const char *);
 int     droppriv(struct thread_info *);
 int     logretention(char *);
 int     postcmd(struct thread_info *, char *);
+int     cancelusleep(unsigned int);
+int     postqueue_depth(void);
 int     workcmd(int, char **, char **);
 off_t   logsize(char *);
 size_t  strlcat(char *, const char *, size_t);
 size_t  strlcpy(char *, const char *, size_t);
+struct scangroup *scangroup(struct thread_info *, bool);
 uid_t   verifyuid(const char *);
+unsigned int cancelsleep(unsigned int);
 uint32_t findfile(struct thread_info *, bool, uint32_t *, char *, sqlite3 *);
+uint32_t scanwalks(struct thread_info *);
+uint64_t cputime(void);
+uint64_t monotime(void);
 void    activethreads(struct thread_info *);
+void    dblock_lock(struct thread_info *);
+void    expremoved(struct thread_info *, struct expstate *, unsigned long long);
 void   *dfsthread(void *);
 void   *expthread(void *);
+void    metrics_wait(void);
+void    phase_add(struct thread_info *, enum phase, uint64_t);
+void    phase_report(struct thread_info *, struct phasesnap *);
+void    phase_snap(struct thread_info *, struct phasesnap *);
+void    phase_start(struct phaseclock *);
+void    phase_stop(struct thread_info *, enum phase, struct phaseclock *);
 void    parentsignals(void);
+void    postqueue_wait(struct thread_info *);
 void    rlimit(int);
+void    scanbegin(struct thread_info *);
+void    scandone(struct thread_info *, uint32_t);
+void    scanleave(struct thread_info *);
+void    scanstale(struct thread_info *);
 void   *slmthread(void *);
+void    slmwake(void);
 void    strreplace(char *, const char *, const char *, size_t);
 void   *workthread(void *);
 
 /* sqlite */
 
 #define	SQLMEMDB	":memory:"						/* pure in-memory database */
-#define	QUERYLIM	100000							/* max return for dfs and exp */
+#define	QUERYLIM	100000							/* dfs and exp rows per keyset page */
 
 bool    create_index(struct thread_info *, sqlite3 *);
 bool    create_table(struct thread_info *, sqlite3 *);
+bool    create_views(struct thread_info *, sqlite3 *);
 bool    drop_table(struct thread_info *, sqlite3 *);
+bool    drop_views(struct thread_info *, sqlite3 *);
 bool    journal_mode(struct thread_info *, sqlite3 *);
+bool    schema_init(char *, sqlite3 *);
 bool    sqlexec(struct thread_info *, sqlite3 *, char *, char *, ...);
 bool    sync_commit(struct thread_info *, sqlite3 *);
 uint32_t count_dirs(struct thread_info *, sqlite3 *);
 uint32_t count_files(struct thread_info *, sqlite3 *);
+unsigned long long dir_bytes(struct thread_info *, sqlite3 *);
+void    expfiles(struct thread_info *, sqlite3 *);
 void    process_dirs(struct thread_info *, sqlite3 *);
 
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
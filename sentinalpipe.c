@@ -2,7 +2,10 @@
  * sentinalpipe.c
  * The purpose of this program is to prevent SIGPIPE from being sent
  * to processes writing to pipes.  Keep pipes given in the INI file,
- * if they exist, always open for reading.
+ * if they exist, always open for reading.  inotify watches on the
+ * pipes' directories reopen a pipe as soon as it is created or replaced.
+ * With --drain, FIFO data is spooled to a file while sentinal is down;
+ * the workthread replays the spool when it reattaches.
  *
  * Copyright (c) 2021-2026 jjb
  * All rights reserved.
@@ -16,11 +19,14 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,21 +35,39 @@
 #include "basename.h"
 #include "ini.h"
 
+#define	DIRFLAGS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+					 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#define	SPOOLMAX	(1L << 30)						/* 1GiB per pipe, then writers block */
+#define	SPOOLCHUNK	(1 << 20)						/* splice size per locked append */
+
 struct pipeinfo {
 	char   *pi_pipename;							/* FIFO name */
+	char   *pi_pipedir;								/* FIFO directory */
 	int     pi_fd;									/* fd from open(2) */
+	int     pi_wd;									/* pipedir watch, -1 unwatched */
+	bool    pi_drain;								/* spool while sentinal is down */
+	bool    pi_hup;									/* no writer, skip until next tick */
+	bool    pi_full;								/* spool at SPOOLMAX, skip until next tick */
 };
 
-static struct pipeinfo pipelist[MAXSECT];			/* list of pipes and open fds */
+static struct pipeinfo *pipelist;					/* list of pipes and open fds */
+static int npipes;									/* pipes in pipelist */
 static volatile sig_atomic_t stop_requested;		/* delayed exit on service restart */
+static char *pidfile;								/* sentinal pid, from the INI file */
 
+static bool sentinal_down(void);
 static void help(char *);
+static bool pipedrain(int);
+static void pipeevents(int);
 static void pipeopen(int);
+static bool pipewatch(int, int);
 static void sigcatch(int);
-static void systemd_signals(void);
+static void systemd_signals(sigset_t *);
 
 static struct option long_options[] = {
 	{ "ini-file", required_argument, NULL, 'f' },
+	{ "drain", no_argument, NULL, 'd' },
 	{ "version", no_argument, NULL, 'V' },
 	{ "help", no_argument, NULL, 'h' },
 	{ 0, 0, 0, 0 }
@@ -51,27 +75,40 @@ static struct option long_options[] = {
 
 int main(int argc, char *argv[])
 {
+	bool    drain = false;							/* spool while sentinal is down */
+	bool    draining = false;						/* sentinal is down */
+	bool    unwatched;								/* a pipedir watch is missing */
 	char    filename[PATH_MAX];						/* full pathname */
 	char    inifile[PATH_MAX];						/* ini file name */
 	char   *my_ini(ini_t *, char *, char *);
 	char   *myname;
 	char   *p1, *p2;
 	char    rbuf[PATH_MAX];
-	char   *sections[MAXSECT];						/* section names */
+	char  **sections;								/* section names */
 	char    tbuf[PATH_MAX];
 	ini_t  *inidata;								/* loaded ini data */
 	int     c;
-	int     get_sections(ini_t *, int, char **);
+	int     get_sections(ini_t *, char ***);
 	int     i;
 	int     index = 0;
+	int     n;
+	int     nfd;									/* inotify instance */
+	int     nfds;									/* entries in fds */
 	int     nsect;									/* number of sections found */
+	int    *fdpipe;								/* fds index -> pipelist index */
+	sigset_t origmask;								/* signals unblocked in ppoll */
+	struct pollfd *fds;
+	struct timespec timeout = { ONE_MINUTE, 0 };	/* retry missing pipedirs */
+	struct timespec tick = { 1, 0 };				/* sentinal check while draining */
+	time_t  now;
+	time_t  last = 0;								/* last sentinal check */
 
 	myname = base(argv[0]);
 
 	*inifile = '\0';
 
 	while(1) {
-		c = getopt_long(argc, argv, "f:Vh?", long_options, &index);
+		c = getopt_long(argc, argv, "df:Vh?", long_options, &index);
 
 		if(c == -1)									/* end of options */
 			break;
@@ -82,6 +119,10 @@ int main(int argc, char *argv[])
 			fprintf(stdout, "%s: version %s\n", myname, VERSION_STRING);
 			exit(EXIT_SUCCESS);
 
+		case 'd':									/* spool while sentinal is down */
+			drain = true;
+			break;
+
 		case 'f':									/* INI file name */
 			fullpath("/opt/sentinal/etc", optarg, inifile);
 			break;
@@ -103,17 +144,35 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if((nsect = get_sections(inidata, MAXSECT, sections)) == 0) {
+	if((nsect = get_sections(inidata, &sections)) == 0) {
 		fprintf(stderr, "%s: nothing to do\n", myname);
 		exit(EXIT_FAILURE);
 	}
 
 	if(nsect < 0) {
-		fprintf(stderr, "%s: too many sections\n", myname);
+		fprintf(stderr, "%s: can't read sections\n", myname);
+		exit(EXIT_FAILURE);
+	}
+
+	if(drain) {
+		p1 = my_ini(inidata, "global", "pidfile");
+
+		if(IS_NULL(p1) || *p1 != '/' || (pidfile = strdup(p1)) == NULL) {
+			fprintf(stderr, "%s: drain requires an absolute global pidfile\n", myname);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pipelist = calloc(nsect, sizeof(struct pipeinfo));
+	fds = calloc(nsect + 1, sizeof(struct pollfd));
+	fdpipe = calloc(nsect + 1, sizeof(int));
+
+	if(pipelist == NULL || fds == NULL || fdpipe == NULL) {
+		fprintf(stderr, "%s: out of memory\n", myname);
 		exit(EXIT_FAILURE);
 	}
 
-	rlimit(MAXFILES);								/* limit the number of open files */
+	rlimit(MAXFILES + nsect);						/* limit the number of open files */
 
 	for(i = 0; i < nsect; i++) {
 		p1 = my_ini(inidata, sections[i], "dirname");
@@ -144,19 +203,38 @@ int main(int argc, char *argv[])
 		}
 
 		fullpath(rbuf, base(p2), filename);
-		pipelist[i].pi_pipename = strndup(filename, PATH_MAX - 1);
+		pipelist[npipes].pi_pipename = strndup(filename, PATH_MAX - 1);
+		pipelist[npipes].pi_pipedir = strndup(rbuf, PATH_MAX - 1);
 
-		if(IS_NULL(pipelist[i].pi_pipename)) {
+		if(IS_NULL(pipelist[npipes].pi_pipename) || IS_NULL(pipelist[npipes].pi_pipedir)) {
 			fprintf(stderr, "%s: out of memory\n", myname);
 			exit(EXIT_FAILURE);
 		}
 
-		pipelist[i].pi_fd = EOF;
+		pipelist[npipes].pi_fd = EOF;
+		pipelist[npipes].pi_wd = -1;
 
-		fprintf(stderr, "monitor %s\n", pipelist[i].pi_pipename);
+		/* only sentinal workers replay a spool */
+
+		pipelist[npipes].pi_drain = drain && NOT_NULL(my_ini(inidata, sections[i], "command"));
+
+		fprintf(stderr, "monitor %s%s\n", pipelist[npipes].pi_pipename,
+				pipelist[npipes].pi_drain ? ", drain" : "");
+		npipes++;
 	}
 
-	systemd_signals();
+	if((nfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		fprintf(stderr, "%s: inotify_init1 failed: %s\n", myname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	systemd_signals(&origmask);
+
+	/* watch first, then open, so a pipe created in between is not missed */
+
+	for(i = 0; i < npipes; i++)
+		if(pipewatch(nfd, i) == false)
+			pipeopen(i);
 
 	for(;;) {
 		if(stop_requested) {
@@ -165,19 +243,112 @@ int main(int argc, char *argv[])
 			exit(EXIT_SUCCESS);
 		}
 
-		for(i = 0; i < nsect; i++)
-			pipeopen(i);
+		for(unwatched = false, i = 0; i < npipes; i++)
+			if(pipelist[i].pi_wd == -1 && pipewatch(nfd, i) == false)
+				unwatched = true;
+
+		/*
+		 * drain: read FIFOs only while sentinal's pidfile is unlocked
+		 * a FIFO without writers polls POLLHUP, skip it until the next tick
+		 */
+
+		if(drain && (now = time(NULL)) != last) {
+			last = now;
+			draining = sentinal_down();
+
+			for(i = 0; i < npipes; i++)
+				pipelist[i].pi_hup = pipelist[i].pi_full = false;
+		}
+
+		fds[0].fd = nfd;
+		fds[0].events = POLLIN;
+		nfds = 1;
+
+		for(i = 0; draining && i < npipes; i++) {
+			if(!pipelist[i].pi_drain || pipelist[i].pi_fd == EOF ||
+			   pipelist[i].pi_hup || pipelist[i].pi_full)
+				continue;
+
+			fds[nfds].fd = pipelist[i].pi_fd;
+			fds[nfds].events = POLLIN;
+			fdpipe[nfds++] = i;
+		}
+
+		/* signals are delivered only while waiting */
+
+		n = ppoll(fds, nfds, drain ? &tick : unwatched ? &timeout : NULL, &origmask);
 
-		if(stop_requested)
+		if(n <= 0)
 			continue;
 
-		sleep(ONE_MINUTE);
+		/* sentinal back, stop polling the FIFOs now, not at the next tick */
+
+		for(i = 1; i < nfds; i++)
+			if(fds[i].revents & POLLIN) {
+				if(draining && !pipedrain(fdpipe[i]))
+					draining = false;
+			} else if(fds[i].revents & (POLLHUP | POLLERR))
+				pipelist[fdpipe[i]].pi_hup = true;
+
+		if(fds[0].revents & POLLIN)
+			pipeevents(nfd);
 	}
 
 	/* notreached */
 	exit(EXIT_SUCCESS);
 }
 
+static bool pipewatch(int nfd, int i)
+{
+	/* pipes in the same directory share a watch descriptor */
+
+	if((pipelist[i].pi_wd = inotify_add_watch(nfd, pipelist[i].pi_pipedir, DIRFLAGS)) == -1)
+		return (false);
+
+	pipeopen(i);									/* may have changed while unwatched */
+	return (true);
+}
+
+static void pipeevents(int nfd)
+{
+	char    buf[BUFSIZ] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char   *p;
+	int     i;
+	ssize_t n;
+	struct inotify_event *event;
+
+	while((n = read(nfd, buf, BUFSIZ)) > 0)
+		for(p = buf; p < buf + n; p += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)p;
+
+			if(event->mask & IN_Q_OVERFLOW) {		/* events lost, recheck all */
+				for(i = 0; i < npipes; i++)
+					pipeopen(i);
+
+				continue;
+			}
+
+			for(i = 0; i < npipes; i++) {
+				if(pipelist[i].pi_wd != event->wd)
+					continue;
+
+				if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+					/* pipedir is gone, rewatch when it returns */
+
+					if(!(event->mask & IN_IGNORED))
+						inotify_rm_watch(nfd, event->wd);
+
+					pipelist[i].pi_wd = -1;
+					pipeopen(i);
+					continue;
+				}
+
+				if(event->len && strcmp(event->name, base(pipelist[i].pi_pipename)) == 0)
+					pipeopen(i);
+			}
+		}
+}
+
 static void pipeopen(int i)
 {
 	/* keep pipes open by opening a new fd before closing the old fd */
@@ -186,9 +357,6 @@ static void pipeopen(int i)
 	int     newfd;
 	struct stat st;
 
-	if(IS_NULL(pipelist[i].pi_pipename))			/* INI file error */
-		return;
-
 	if(lstat(pipelist[i].pi_pipename, &st) == -1 || !S_ISFIFO(st.st_mode)) {
 		/* not yet created or gone missing */
 
@@ -199,7 +367,7 @@ static void pipeopen(int i)
 		return;
 	}
 
-	newfd = open(pipelist[i].pi_pipename, O_RDONLY | O_NONBLOCK);
+	newfd = open(pipelist[i].pi_pipename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
 	if(newfd == -1) {
 		/* keep the existing reader if a replacement open fails */
 		pipelist[i].pi_fd = savefd;
@@ -212,11 +380,84 @@ static void pipeopen(int i)
 		close(savefd);
 }
 
-static void systemd_signals(void)
+static bool sentinal_down(void)
 {
-	/* catch signals sent by systemctl commands */
+	/* sentinal holds a lockf(3) lock on its pidfile while it runs */
+
+	bool    down;
+	int     fd;
+	struct flock fl;
+
+	if((fd = open(pidfile, O_RDONLY | O_CLOEXEC)) == -1)
+		return (true);
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	down = fcntl(fd, F_GETLK, &fl) == 0 && fl.l_type == F_UNLCK;
+	close(fd);
+	return (down);
+}
+
+static bool pipedrain(int i)
+{
+	/*
+	 * append FIFO data to pipename.spool, one locked chunk at a time
+	 * sentinal locks the spool to replay it, recheck it is still down
+	 * false when sentinal is back and nothing was read
+	 */
+
+	bool    down = true;							/* sentinal_down() */
+	char    spool[PATH_MAX];
+	int     fd;
+	off_t   off;
+	ssize_t n;
+	struct stat st;
+
+	snprintf(spool, PATH_MAX, "%s%s", pipelist[i].pi_pipename, SPOOLEXT);
+
+	if((fd = open(spool, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) == -1) {
+		fprintf(stderr, "can't open %s: %s\n", spool, strerror(errno));
+		pipelist[i].pi_hup = true;					/* retry next tick */
+		return (true);
+	}
+
+	if(flock(fd, LOCK_EX | LOCK_NB) == -1) {		/* replay in progress */
+		close(fd);
+		pipelist[i].pi_hup = true;
+		return (true);
+	}
+
+	if((down = sentinal_down()) && fstat(fd, &st) == 0) {
+		/* splice advances off */
+
+		for(off = st.st_size, n = 1; n > 0 && off < SPOOLMAX;)
+			n = splice(pipelist[i].pi_fd, NULL, fd, &off, SPOOLCHUNK,
+					   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if(off >= SPOOLMAX) {
+			if(st.st_size < SPOOLMAX)
+				fprintf(stderr, "%s: spool full, writers will block\n", spool);
+
+			pipelist[i].pi_full = true;
+		}
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	return (down);
+}
+
+static void systemd_signals(sigset_t *origmask)
+{
+	/*
+	 * catch signals sent by systemctl commands
+	 * they stay blocked except in ppoll, so none is lost before the wait
+	 */
 
 	int     i;
+	sigset_t blockmask;
 	struct sigaction sacatch;
 
 	memset(&sacatch, 0, sizeof(sacatch));
@@ -224,8 +465,14 @@ static void systemd_signals(void)
 	sigemptyset(&sacatch.sa_mask);
 	sacatch.sa_flags = 0;
 
-	for(i = 0; i < 2; i++)
+	sigemptyset(&blockmask);
+
+	for(i = 0; i < 2; i++) {
 		sigaction((i == 0) ? SIGHUP : SIGTERM, &sacatch, NULL);
+		sigaddset(&blockmask, (i == 0) ? SIGHUP : SIGTERM);
+	}
+
+	sigprocmask(SIG_BLOCK, &blockmask, origmask);
 }
 
 static void sigcatch(int sig)
@@ -242,9 +489,10 @@ static void sigcatch(int sig)
 
 static void help(char *prog)
 {
-	fprintf(stderr, "Usage: %s -f ini-file [-V]\n", base(prog));
+	fprintf(stderr, "Usage: %s -f ini-file [-d] [-V]\n", base(prog));
 	fprintf(stderr,
 			" -f, --ini-file   INI file, full path or relative to /opt/sentinal/etc\n");
+	fprintf(stderr, " -d, --drain      spool FIFO data while sentinal is down\n");
 	fprintf(stderr, " -V, --version    print version number, exit\n");
 	fprintf(stderr, " -?, --help       this message\n");
 }
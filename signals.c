@@ -22,7 +22,7 @@
 static void sigparent(int);
 static void sigreject(int);
 
-extern struct thread_info tinfo[MAXSECT];			/* our threads */
+extern volatile sig_atomic_t reload_requested;		/* SIGHUP: reread the INI file */
 
 void parentsignals(void)
 {
@@ -70,19 +70,17 @@ static void sigparent(int sig)
 {
 	/* parent signal handler */
 
-	int     i;
-
 	signal(sig, sigparent);							/* reset */
 
 	if(sig == SIGINT || sig == SIGTERM)
 		_exit(EXIT_SUCCESS);
 
-	/* mark the threads as signaled */
-	/* only workers use ti_wfd */
+	if(sig == SIGHUP) {
+		hupcount++;									/* threads see HUPPED() */
+		reload_requested = true;					/* main thread diffs the INI file */
+	}
 
-	for(i = 0; i < MAXSECT; i++)
-		if(NOT_NULL(tinfo[i].ti_section))
-			tinfo[i].ti_sig = tinfo[i].ti_wfd != EOF ? sig : 0;
+	slmwake();										/* don't wait for the next event */
 }
 
 static void sigreject(int sig)
@@ -1,8 +1,12 @@
 /*
  * slmthread.c
  * Simple log monitor thread.
+ * One dispatcher thread, one epoll set and one inotify instance serve
+ * every slm section.  File sizes are tracked from IN_MODIFY events with
+ * fstat(2) on a held descriptor; postcmd jobs are queued as files cross
+ * rotatesiz, at most one per section.
  *
- * Copyright (c) 2021-2025 jjb
+ * Copyright (c) 2021-2026 jjb
  * All rights reserved.
  *
  * This source code is licensed under the MIT license found
@@ -14,30 +18,82 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "sentinal.h"
 
-#define	SCANRATE		2							/* default monitor rate */
-#define	POLLTIMEOUT		(120 * 1000)				/* 2 minutes in milliseconds */
+#define	SCANRATE		2							/* rearm rate for missing files */
+#define	EPOLLTIMEOUT	(120 * 1000)				/* 2 minutes in milliseconds */
 
-#define	ROTATE(lim,n,sig)	((lim && n > lim) || sig == SIGHUP)
-#define	STAT(file,buf)		(stat(file, &buf) == -1 ? -1 : buf.st_size)
+#define	ROTATE(lim,n,ti)	((lim && n > lim) || HUPPED(ti))
 
-static bool inotify_watch(char *, char *);
+/*
+ * the held fd keeps an unlinked file's inode alive, so removing it
+ * reports IN_ATTRIB (link count), never IN_DELETE_SELF, see slmgone()
+ */
+
+#define	WATCHFLAGS	(IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+#define	EV_NOTIFY	0								/* epoll data: inotify fd */
+#define	EV_WAKEUP	1								/* epoll data: eventfd */
+
+struct slminfo {
+	struct thread_info *sl_ti;						/* section settings */
+	char    sl_filename[PATH_MAX];					/* full pathname */
+	int     sl_wd;									/* watch descriptor, -1 unarmed */
+	int     sl_fd;									/* held for fstat, -1 use stat */
+	off_t   sl_size;								/* last known size */
+};
+
+struct slmtable {
+	struct slminfo *st_slm;							/* slm sections */
+	int     st_nslm;								/* number of slm sections */
+	int    *st_wdhash;								/* wd -> st_slm indexes, -1 empty */
+	int     st_hashsiz;								/* power of 2 */
+	int     st_nfd;									/* inotify instance */
+	int     st_epfd;								/* epoll instance */
+};
+
+static bool slmarm(int, struct slmtable *, int);
+static bool slmgone(struct slminfo *);
+static bool slmsize(struct slmtable *, int);
+static int slmlookup(struct slmtable *, int, int *);
+static void slmcancel(void *);
+static void slmdisarm(int, struct slmtable *, int, bool);
+static void slmevents(int, struct slmtable *);
+static void slmhash(struct slmtable *);
+static void slmqueue(struct slmtable *, int);
+
+static int wakefd = -1;								/* eventfd for slmwake(), kept across reloads */
+
+extern int ntinfo;									/* number of sections */
+extern struct thread_info **tinfo;					/* our threads */
 
 void   *slmthread(void *arg)
 {
-	char    filename[PATH_MAX];						/* full pathname */
-	int     status;									/* postcmd child exit */
-	struct stat stbuf;								/* file status */
-	struct thread_info *ti = arg;					/* thread settings */
+	bool    rehash;									/* a watch descriptor changed */
+	bool    unarmed;								/* some file is not watched */
+	int     epfd;									/* epoll instance */
+	int     i;
+	int     n;
+	int     nfd;									/* inotify instance */
+	int     timeout;								/* epoll_wait timeout */
+	struct epoll_event ev;
+	struct epoll_event events[2];
+	struct slmtable st;								/* slm sections */
+	struct thread_info *ti;							/* thread settings */
+	uint64_t count;									/* eventfd counter */
 
 	/*
-	 * this thread requires:
+	 * each section requires:
 	 *  - ti_command unset
 	 *  - ti_template
 	 *  - ti_postcmd
@@ -49,70 +105,307 @@ void   *slmthread(void *arg)
 	 *  - ti_truncate
 	 */
 
-	pthread_setname_np(pthread_self(), threadname(ti, _SLM_THR));
+	(void)arg;
+	pthread_setname_np(pthread_self(), "sentinal_slm");
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	/* see cancelsleep */
+
+	memset(&st, '\0', sizeof(st));
+	st.st_nfd = st.st_epfd = -1;
 
-	/* for slm, ti->ti_template is the logname */
+	for(i = 0; i < ntinfo; i++)
+		if(threadtype(tinfo[i], _SLM_THR))
+			st.st_nslm++;
 
-	fullpath(ti->ti_dirname, ti->ti_template, filename);
+	if(st.st_nslm == 0)
+		return ((void *)0);
+
+	for(st.st_hashsiz = 4; st.st_hashsiz < st.st_nslm * 2; st.st_hashsiz <<= 1)
+		continue;
+
+	st.st_slm = calloc(st.st_nslm, sizeof(struct slminfo));
+	st.st_wdhash = calloc(st.st_hashsiz, sizeof(int));
+
+	if(!st.st_slm || !st.st_wdhash) {
+		fprintf(stderr, "%s: calloc failed\n", _SLM_THR);
+		return ((void *)0);
+	}
+
+	for(n = i = 0; i < ntinfo; i++) {
+		ti = tinfo[i];								/* shorthand */
+
+		if(!threadtype(ti, _SLM_THR))
+			continue;
+
+		if(threadname(ti, _SLM_THR) == NULL)		/* postcmd checks ti_task */
+			continue;
+
+		/* for slm, ti->ti_template is the logname */
+
+		st.st_slm[n].sl_ti = ti;
+		st.st_slm[n].sl_wd = -1;
+		st.st_slm[n].sl_fd = -1;
+		fullpath(ti->ti_dirname, ti->ti_template, st.st_slm[n].sl_filename);
 
-	if(ti->ti_rotatesiz)							/* mandatory, check anyway */
 		fprintf(stderr, "%s: monitor file: %s for size %s\n",
-				ti->ti_section, filename, ti->ti_rotatestr);
+				ti->ti_section, st.st_slm[n].sl_filename, ti->ti_rotatestr);
+
+		n++;									/* a SIGHUP while stopped still rotates */
+	}
+
+	st.st_nslm = n;
+	slmhash(&st);
+
+	if(wakefd == -1)
+		wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if((st.st_nfd = nfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+	   wakefd == -1 || (st.st_epfd = epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		fprintf(stderr, "%s: can't create event descriptors\n", _SLM_THR);
+		slmcancel(&st);
+		return ((void *)0);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = EV_NOTIFY;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, nfd, &ev);
 
-	ti->ti_sig = 0;									/* reset */
+	ev.events = EPOLLIN;
+	ev.data.u32 = EV_WAKEUP;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	/*
+	 * watches persist across iterations
+	 * rearm only when a file is moved, deleted, or not yet created
+	 * a reload stops this thread in epoll_wait and starts a new one
+	 */
+
+	pthread_cleanup_push(slmcancel, &st);
 
 	for(;;) {
-		if(ROTATE(ti->ti_rotatesiz, STAT(filename, stbuf), ti->ti_sig)) {
-			/* ti->ti_rotatesiz or signaled to post-process */
+		rehash = unarmed = false;
 
-			if((status = postcmd(ti, filename)) != 0) {
-				fprintf(stderr, "%s: postcmd exit: %d\n", ti->ti_section, status);
-				sleep(5);							/* be nice */
+		for(i = 0; i < st.st_nslm; i++) {
+			if(st.st_slm[i].sl_wd == -1) {
+				if(slmarm(nfd, &st, i))
+					rehash = true;
+				else
+					unarmed = true;
 			}
 
-			ti->ti_sig = 0;							/* reset */
+			if(HUPPED(st.st_slm[i].sl_ti))
+				slmqueue(&st, i);
 		}
 
-		if(inotify_watch(ti->ti_section, filename) == false)
-			sleep(SCANRATE);						/* in lieu of inotify */
+		if(rehash)
+			slmhash(&st);
+
+		timeout = unarmed ? SCANRATE * 1000 : EPOLLTIMEOUT;
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		n = epoll_wait(epfd, events, 2, timeout);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		for(i = 0; i < n; i++)
+			if(events[i].data.u32 == EV_NOTIFY)
+				slmevents(nfd, &st);
+			else
+				read(wakefd, &count, sizeof(count));	/* signaled */
+
+		if(n == 0 && timeout == EPOLLTIMEOUT)		/* quiet, check everything */
+			for(i = 0; i < st.st_nslm; i++)
+				if(slmsize(&st, i))
+					slmqueue(&st, i);
 	}
 
+	pthread_cleanup_pop(1);
+
 	/* notreached */
 	return ((void *)0);
 }
 
-static bool inotify_watch(char *section, char *filename)
+void slmwake(void)
 {
-	char    buf[BUFSIZ] __attribute__((aligned(__alignof__(struct inotify_event))));
-	int     fd = -1;
-	int     wd = -1;
-	int     watchflags = IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF;
-	struct pollfd fds[1];
+	/* called from the signal handler, async-signal-safe */
 
-	if(access(filename, R_OK) == -1 || (fd = inotify_init1(IN_NONBLOCK)) == -1)
-		return (false);
+	uint64_t one = 1;
 
-	if((wd = inotify_add_watch(fd, filename, watchflags)) == -1) {
-		close(fd);
+	if(wakefd != -1)
+		write(wakefd, &one, sizeof(one));
+}
+
+static void slmcancel(void *arg)
+{
+	/* release everything but wakefd */
+
+	int     i;
+	struct slmtable *st = arg;
+
+	for(i = 0; i < st->st_nslm; i++)
+		if(st->st_slm[i].sl_fd != -1)
+			close(st->st_slm[i].sl_fd);
+
+	if(st->st_nfd != -1)
+		close(st->st_nfd);							/* removes the watches */
+
+	if(st->st_epfd != -1)
+		close(st->st_epfd);
+
+	free(st->st_slm);
+	free(st->st_wdhash);
+}
+
+static bool slmarm(int nfd, struct slmtable *st, int i)
+{
+	struct slminfo *sl = &st->st_slm[i];			/* shorthand */
+
+	if((sl->sl_wd = inotify_add_watch(nfd, sl->sl_filename, WATCHFLAGS)) == -1)
 		return (false);
+
+	if(sl->sl_fd != -1)
+		close(sl->sl_fd);
+
+	/* hold the file for fstat, fall back to stat if out of descriptors */
+
+	sl->sl_fd = open(sl->sl_filename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if(slmsize(st, i))								/* may have grown while unwatched */
+		slmqueue(st, i);
+
+	return (true);
+}
+
+static bool slmsize(struct slmtable *st, int i)
+{
+	/* update the size, return true if the file needs post-processing */
+
+	struct slminfo *sl = &st->st_slm[i];			/* shorthand */
+	struct stat stbuf;								/* file status */
+
+	if(sl->sl_fd != -1 ? fstat(sl->sl_fd, &stbuf) : stat(sl->sl_filename, &stbuf))
+		sl->sl_size = -1;
+	else if(stbuf.st_nlink == 0) {					/* removed, rearm on the path */
+		slmdisarm(st->st_nfd, st, i, true);
+		sl->sl_size = -1;
+	} else
+		sl->sl_size = stbuf.st_size;
+
+	return (ROTATE(sl->sl_ti->ti_rotatesiz, sl->sl_size, sl->sl_ti));
+}
+
+static void slmqueue(struct slmtable *st, int i)
+{
+	/* ti->ti_rotatesiz or signaled to post-process */
+
+	struct slminfo *sl = &st->st_slm[i];			/* shorthand */
+	struct thread_info *ti = sl->sl_ti;				/* thread settings */
+
+	if(postqueue_once(ti, sl->sl_filename))		/* one job per section */
+		METRIC_ADD(ti, mt_rotations, 1);
+
+	HUPRESET(ti);
+}
+
+static void slmhash(struct slmtable *st)
+{
+	/* rebuild the wd lookup, watches change only on rearm */
+
+	int     h;
+	int     i;
+	int     mask = st->st_hashsiz - 1;
+
+	for(h = 0; h < st->st_hashsiz; h++)
+		st->st_wdhash[h] = -1;
+
+	for(i = 0; i < st->st_nslm; i++) {
+		if(st->st_slm[i].sl_wd == -1)
+			continue;
+
+		for(h = st->st_slm[i].sl_wd & mask; st->st_wdhash[h] != -1; h = (h + 1) & mask)
+			continue;
+
+		st->st_wdhash[h] = i;
 	}
+}
 
-	fds[0].fd = fd;
-	fds[0].events = POLLIN;
+static int slmlookup(struct slmtable *st, int wd, int *hp)
+{
+	/*
+	 * the next section watching wd, probing from *hp, -1 when there are no more
+	 * sections monitoring the same file share its wd, each gets the event
+	 */
 
-	/* poll defers our noticing SIGHUP */
+	int     i;
+	int     mask = st->st_hashsiz - 1;
 
-	if(poll(fds, 1, POLLTIMEOUT) > 0)
-		if(read(fd, buf, BUFSIZ) > 0) {
-			struct inotify_event *event = (struct inotify_event *)buf;
+	for(; st->st_wdhash[*hp] != -1; *hp = (*hp + 1) & mask)
+		if(st->st_slm[i = st->st_wdhash[*hp]].sl_wd == wd) {
+			*hp = (*hp + 1) & mask;
+			return (i);
+		}
+
+	return (-1);
+}
+
+static void slmevents(int nfd, struct slmtable *st)
+{
+	char    buf[BUFSIZ] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char   *p;
+	int     h;										/* slmlookup() probe */
+	int     i;
+	ssize_t n;
+	struct inotify_event *event;
+	struct slminfo *sl;
+
+	while((n = read(nfd, buf, BUFSIZ)) > 0)
+		for(p = buf; p < buf + n; p += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)p;
+			h = event->wd & (st->st_hashsiz - 1);
 
-			if(event->mask & IN_MOVE_SELF)
-				fprintf(stderr, "%s: %s moved\n", section, filename);
+			while((i = slmlookup(st, event->wd, &h)) != -1) {	/* none: stale watch */
+				sl = &st->st_slm[i];
+
+				if(event->mask & IN_MODIFY)
+					if(slmsize(st, i))
+						slmqueue(st, i);
+
+				if(event->mask & IN_MOVE_SELF)
+					fprintf(stderr, "%s: %s moved\n", sl->sl_ti->ti_section, sl->sl_filename);
+
+				if(event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED) ||
+				   (event->mask & IN_ATTRIB && slmgone(sl)))
+					slmdisarm(nfd, st, i, !(event->mask & IN_IGNORED));
+			}
 		}
+}
 
-	inotify_rm_watch(fd, wd);
-	close(fd);
-	return (true);
+static bool slmgone(struct slminfo *sl)
+{
+	/* unlinked while we hold it, or the path no longer names it */
+
+	struct stat stbuf;								/* file status */
+
+	if(sl->sl_fd != -1)
+		return (fstat(sl->sl_fd, &stbuf) == -1 || stbuf.st_nlink == 0);
+
+	return (stat(sl->sl_filename, &stbuf) == -1);
+}
+
+static void slmdisarm(int nfd, struct slmtable *st, int i, bool rmwatch)
+{
+	/* the path names a new file, or none yet */
+
+	struct slminfo *sl = &st->st_slm[i];			/* shorthand */
+
+	if(sl->sl_wd == -1)
+		return;
+
+	if(rmwatch)										/* EINVAL if a section sharing it did */
+		inotify_rm_watch(nfd, sl->sl_wd);
+
+	if(sl->sl_fd != -1)
+		close(sl->sl_fd);							/* frees a removed file's space */
+
+	sl->sl_wd = sl->sl_fd = -1;						/* lookup rebuilt at rearm */
 }
 
 /* vim: set tabstop=4 shiftwidth=4 noexpandtab: */
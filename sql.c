@@ -23,15 +23,34 @@
 #define RETRY_DELAY_USEC	100000
 #define SQL_DIR_FMT			"DROP TABLE IF EXISTS \"%s_dir\";"
 #define SQL_FILE_FMT		"DROP TABLE IF EXISTS \"%s_file\";"
+#define SCHEMA_VERSION		2							/* PRAGMA user_version */
+#define CACHE_KIB			16384						/* PRAGMA cache_size, KiB */
+#define MMAP_BYTES			(256 << 20)					/* PRAGMA mmap_size, file databases */
+
+/*
+ * db_id is the rowid, so the join from _file is a rowid lookup
+ * the _file index covers the ORDER BY db_time queries, they never read the table
+ */
+
 #define SQL_CREATE_DIR_FMT \
-	"CREATE TABLE IF NOT EXISTS \"%s_dir\" (db_id INT NOT NULL, db_dir VARCHAR(255) NOT NULL, db_empty BOOLEAN NOT NULL);"
+	"CREATE TABLE IF NOT EXISTS \"%s_dir\" (db_id INTEGER PRIMARY KEY, db_dir TEXT NOT NULL, db_empty BOOLEAN NOT NULL);"
 #define SQL_CREATE_FILE_FMT \
-	"CREATE TABLE IF NOT EXISTS \"%s_file\" (db_dirid INT NOT NULL, db_file VARCHAR(255) NOT NULL, db_time INT NOT NULL, db_size BIGINT NOT NULL);"
-#define SQL_INDEX_DIR_FMT	"CREATE INDEX IF NOT EXISTS \"idx_%s_dir\" ON \"%s_dir\" (db_id);"
-#define SQL_INDEX_FILE_FMT	"CREATE INDEX IF NOT EXISTS \"idx_%s_file\" ON \"%s_file\" (db_time);"
+	"CREATE TABLE IF NOT EXISTS \"%s_file\" (db_dirid INTEGER NOT NULL, db_file TEXT NOT NULL, db_time INTEGER NOT NULL, db_size INTEGER NOT NULL);"
+#define SQL_INDEX_FILE_FMT \
+	"CREATE INDEX IF NOT EXISTS \"idx_%s_file\" ON \"%s_file\" (db_time, db_dirid, db_file, db_size);"
 #define SQL_COUNT_DIR_FMT	"SELECT COUNT(*) FROM \"%s_dir\" WHERE db_empty = 1;"
-#define SQL_COUNT_FILE_FMT	"SELECT COUNT(*) FROM \"%s_dir\", \"%s_file\" WHERE db_dirid = db_id;"
+#define SQL_COUNT_FILE_FMT	"SELECT COUNT(*) FROM \"%s_file\";"
+#define SQL_SUM_SIZE_FMT	"SELECT SUM(db_size) FROM \"%s_file\";"
+#define SQL_OLD_TABLES \
+	"SELECT group_concat('DROP TABLE IF EXISTS \"' || name || '\";', ' ') FROM sqlite_master" \
+	" WHERE type = 'table' AND (name GLOB '*_dir' OR name GLOB '*_file');"
 #define SQL_EMPTYDIRS_FMT	"SELECT db_dir FROM \"%s_dir\" WHERE db_empty = 1 ORDER BY db_dir DESC;"
+#define SQL_DROP_VIEW_FMT	"DROP VIEW IF EXISTS temp.\"%s_%s\";"
+#define SQL_VIEW_DIR_FMT \
+	"CREATE TEMP VIEW \"%s_dir\" AS SELECT db_id, db_dir, db_empty FROM \"%s_dir\";"
+#define SQL_VIEW_FILE_FMT \
+	"CREATE TEMP VIEW \"%w_file\" AS SELECT db_dirid, db_file, db_time, db_size FROM \"%w_file\"" \
+	" WHERE substr(db_file, 1, 1) <> '.' AND db_file REGEXP %Q;"
 
 static bool execute_sql(const struct thread_info *ti, sqlite3 *db, const char *desc,
 						const char *format, va_list ap)
@@ -86,24 +105,56 @@ static inline bool run_sql_fmt(const struct thread_info *ti, sqlite3 *db,
 	return (sqlexec((struct thread_info *)ti, db, (char *)desc, "%s", stmtbuf));
 }
 
+/* with sharedscan the tables are the scan group's, see scantable() */
+
 bool drop_table(struct thread_info *ti, sqlite3 *db)
 {
-	return (run_sql_fmt(ti, db, "drop table", SQL_DIR_FMT, ti->ti_task, NULL) &&
-			run_sql_fmt(ti, db, "drop table", SQL_FILE_FMT, ti->ti_task, NULL));
+	return (run_sql_fmt(ti, db, "drop table", SQL_DIR_FMT, scantable(ti), NULL) &&
+			run_sql_fmt(ti, db, "drop table", SQL_FILE_FMT, scantable(ti), NULL));
 }
 
 bool create_table(struct thread_info *ti, sqlite3 *db)
 {
-	return (run_sql_fmt(ti, db, "create table", SQL_CREATE_DIR_FMT, ti->ti_task, NULL) &&
-			run_sql_fmt(ti, db, "create table", SQL_CREATE_FILE_FMT, ti->ti_task, NULL));
+	return (run_sql_fmt(ti, db, "create table", SQL_CREATE_DIR_FMT, scantable(ti), NULL) &&
+			run_sql_fmt(ti, db, "create table", SQL_CREATE_FILE_FMT, scantable(ti), NULL));
 }
 
 bool create_index(struct thread_info *ti, sqlite3 *db)
 {
-	return (run_sql_fmt
-			(ti, db, "create index", SQL_INDEX_DIR_FMT, ti->ti_task, ti->ti_task) &&
-			run_sql_fmt(ti, db, "create index", SQL_INDEX_FILE_FMT, ti->ti_task,
-						ti->ti_task));
+	return (run_sql_fmt(ti, db, "create index", SQL_INDEX_FILE_FMT, scantable(ti),
+						scantable(ti)));
+}
+
+bool drop_views(struct thread_info *ti, sqlite3 *db)
+{
+	return (run_sql_fmt(ti, db, "drop view", SQL_DROP_VIEW_FMT, ti->ti_task, "dir") &&
+			run_sql_fmt(ti, db, "drop view", SQL_DROP_VIEW_FMT, ti->ti_task, "file"));
+}
+
+bool create_views(struct thread_info *ti, sqlite3 *db)
+{
+	/*
+	 * the section's own names over the scan group's tables
+	 * so the dfs and exp queries need no changes
+	 * pcrestr is quoted by sqlite3_mprintf(), REGEXP is pcre2.so's
+	 */
+
+	bool    ok;
+	char   *stmt;
+
+	if(!drop_views(ti, db) ||
+	   !run_sql_fmt(ti, db, "create view", SQL_VIEW_DIR_FMT, ti->ti_task, scantable(ti)))
+		return (false);
+
+	if((stmt = sqlite3_mprintf(SQL_VIEW_FILE_FMT, ti->ti_task, scantable(ti),
+							   ti->ti_pcrestr)) == NULL) {
+		fprintf(stderr, "%s: sqlite3_mprintf failed\n", ti->ti_section);
+		return (false);
+	}
+
+	ok = sqlexec(ti, db, "create view", "%s", stmt);
+	sqlite3_free(stmt);
+	return (ok);
 }
 
 bool journal_mode(struct thread_info *ti, sqlite3 *db)
@@ -146,14 +197,102 @@ static uint32_t get_count(const struct thread_info *ti, sqlite3 *db, const char
 	return (count);
 }
 
+/*
+ * the counts come from ti_stats when findfile() kept them,
+ * the queries are the fallback, e.g. regexp sharedscan views
+ */
+
 uint32_t count_dirs(struct thread_info *ti, sqlite3 *db)
 {
+	if(ti->ti_stats.ts_valid)
+		return (ti->ti_stats.ts_emptydirs);
+
 	return (get_count(ti, db, SQL_COUNT_DIR_FMT, ti->ti_task, NULL));
 }
 
 uint32_t count_files(struct thread_info *ti, sqlite3 *db)
 {
-	return (get_count(ti, db, SQL_COUNT_FILE_FMT, ti->ti_task, ti->ti_task));
+	/* every _file row has its _dir row, no join needed */
+
+	if(ti->ti_stats.ts_valid)
+		return (ti->ti_stats.ts_files);
+
+	return (get_count(ti, db, SQL_COUNT_FILE_FMT, ti->ti_task, NULL));
+}
+
+unsigned long long dir_bytes(struct thread_info *ti, sqlite3 *db)
+{
+	char    stmtbuf[BUFSIZ];						/* statement buffer */
+	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
+	unsigned long long bytes = 0;					/* SUM(db_size) */
+
+	if(ti->ti_stats.ts_valid)
+		return (ti->ti_stats.ts_bytes);
+
+	snprintf(stmtbuf, sizeof(stmtbuf), SQL_SUM_SIZE_FMT, ti->ti_task);
+
+	if(sqlite3_prepare_v2(db, stmtbuf, -1, &pstmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "%s: sqlite3_prepare_v2 (bytes): %s\n",
+				ti->ti_section, sqlite3_errmsg(db));
+
+		return (0);
+	}
+
+	if(sqlite3_step(pstmt) == SQLITE_ROW)
+		bytes = (unsigned long long)sqlite3_column_int64(pstmt, 0);
+
+	sqlite3_finalize(pstmt);
+	return (bytes);
+}
+
+bool schema_init(char *myname, sqlite3 *db)
+{
+	/*
+	 * once, right after sqlite3_open_v2()
+	 * the tables only cache the last walk, so a database from an older
+	 * layout is migrated by dropping them; the threads recreate them
+	 */
+
+	bool    ok = true;
+	char   *errmsg = NULL;
+	char   *pragmas;
+	const char *drops;
+	int     version = 0;
+	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
+
+	if(sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &pstmt, NULL) == SQLITE_OK) {
+		if(sqlite3_step(pstmt) == SQLITE_ROW)
+			version = sqlite3_column_int(pstmt, 0);
+
+		sqlite3_finalize(pstmt);
+	}
+
+	if(version != SCHEMA_VERSION &&
+	   sqlite3_prepare_v2(db, SQL_OLD_TABLES, -1, &pstmt, NULL) == SQLITE_OK) {
+		if(sqlite3_step(pstmt) == SQLITE_ROW &&
+		   (drops = (const char *)sqlite3_column_text(pstmt, 0)) != NULL) {
+			fprintf(stderr, "%s: database schema %d, dropping its tables for %d\n",
+					myname, version, SCHEMA_VERSION);
+
+			ok = sqlite3_exec(db, drops, NULL, NULL, &errmsg) == SQLITE_OK;
+		}
+
+		sqlite3_finalize(pstmt);
+	}
+
+	pragmas = sqlite3_mprintf("PRAGMA user_version = %d; PRAGMA temp_store = MEMORY;"
+							  " PRAGMA cache_size = -%d; PRAGMA mmap_size = %d;",
+							  SCHEMA_VERSION, CACHE_KIB, MMAP_BYTES);
+
+	if(ok)
+		ok = pragmas && sqlite3_exec(db, pragmas, NULL, NULL, &errmsg) == SQLITE_OK;
+
+	if(!ok)
+		fprintf(stderr, "%s: schema_init: %s\n", myname, errmsg ? errmsg : sqlite3_errmsg(db));
+
+	sqlite3_free(errmsg);
+	sqlite3_free(pragmas);
+	return (ok);
 }
 
 void process_dirs(struct thread_info *ti, sqlite3 *db)
@@ -164,6 +303,7 @@ void process_dirs(struct thread_info *ti, sqlite3 *db)
 	int     rc;										/* return code */
 	sqlite3_stmt *pstmt = NULL;						/* prepared statement */
 	uint32_t removed = 0;							/* directories removed */
+	uint64_t t;										/* query timing */
 
 	if(count_dirs(ti, db) < 1)
 		return;
@@ -178,7 +318,14 @@ void process_dirs(struct thread_info *ti, sqlite3 *db)
 		return;
 	}
 
-	while((rc = sqlite3_step(pstmt)) == SQLITE_ROW) {
+	for(;;) {
+		t = monotime();
+		rc = sqlite3_step(pstmt);
+		phase_add(ti, PH_QUERY, monotime() - t);
+
+		if(rc != SQLITE_ROW)
+			break;
+
 		if(dryrun && ++drcount > 10) {
 			if(!ti->ti_terse)
 				fprintf(stderr, "%s: ...\n", ti->ti_section);
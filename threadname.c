@@ -26,7 +26,9 @@ char   *threadname(struct thread_info *ti, char *tname)
 	snprintf(delbuf, BUFSIZ, "_%s", tname);
 	strdel(secbuf, ti->ti_section, delbuf, BUFSIZ);
 
-	if((ti->ti_task = (char *)malloc(TASK_COMM_LEN)) == NULL)
+	/* reused when the slm thread restarts, freed with the section */
+
+	if(ti->ti_task == NULL && (ti->ti_task = (char *)malloc(TASK_COMM_LEN)) == NULL)
 		return (NULL);
 
 	/* add tname to the section name and call it the task name */
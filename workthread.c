@@ -13,8 +13,11 @@
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <stdint.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -25,11 +28,20 @@
 
 #define PIPEBUFSIZ  (4 << 20)						/* 4MiB, better size for IPC i/o */
 
-#define	ROTATE(lim,n,sig)	((lim && n > lim) || sig == SIGHUP)
+#define	ROTATE(lim,n,ti)	((lim && n > lim) || HUPPED(ti))
 #define	STAT(file,buf)		(stat(file, &buf) == -1 ? -1 : buf.st_size)
 
+struct wrkstate {									/* for wrkcancel */
+	struct thread_info *ws_ti;						/* thread settings */
+	char   *ws_filename;							/* full pathname */
+	int    *ws_logfd;								/* primary FIFO fd */
+	int    *ws_holdfd;								/* fd to hold FIFO open */
+};
+
 static int fifoopen(struct thread_info *);
 static void fifosize(struct thread_info *, int);
+static bool spoolreplay(struct thread_info *, char *);
+static void wrkcancel(void *);
 
 void   *workthread(void *arg)
 {
@@ -41,11 +53,13 @@ void   *workthread(void *arg)
 	int     i;
 	int     logfd;									/* primary FIFO fd */
 	int     pipefd[2];								/* pipe readers and writers */
+	bool    rotate;									/* the spool filled this file */
 	int     status;									/* child status codes */
 	ssize_t n;										/* FIFO read */
 	struct passwd *p;
 	struct stat stbuf;								/* file status */
 	struct thread_info *ti = arg;					/* thread settings */
+	struct wrkstate ws = { ti, filename, &logfd, &holdfd };
 
 	/*
 	 * this thread requires:
@@ -65,6 +79,7 @@ void   *workthread(void *arg)
 	 */
 
 	pthread_setname_np(pthread_self(), threadname(ti, _WRK_THR));
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);	/* see cancelsleep */
 
 	fprintf(stderr, "%s: command: %s\n", ti->ti_section, ti->ti_command);
 
@@ -82,14 +97,14 @@ void   *workthread(void *arg)
 		/* set up pipes */
 
 		if((logfd = fifoopen(ti)) == -1) {
-			sleep(ONE_MINUTE);
+			cancelsleep(ONE_MINUTE);
 			continue;
 		}
 
 		if(pipe(pipefd) == -1) {
 			fprintf(stderr, "%s: can't create IPC pipe\n", ti->ti_section);
 			close(logfd);
-			sleep(ONE_MINUTE);
+			cancelsleep(ONE_MINUTE);
 			continue;
 		}
 
@@ -112,7 +127,7 @@ void   *workthread(void *arg)
 			close(logfd);
 			close(pipefd[0]);
 			close(pipefd[1]);
-			sleep(ONE_MINUTE);
+			cancelsleep(ONE_MINUTE);
 			continue;
 
 		case 0:
@@ -150,7 +165,7 @@ void   *workthread(void *arg)
 			} else {
 				/* new stdout -- close parent's and unused fds */
 
-				for(i = 3; i < MAXFILES; i++)
+				for(i = 3; i < sysconf(_SC_OPEN_MAX); i++)
 					close(i);
 
 				/* execution environment */
@@ -184,12 +199,25 @@ void   *workthread(void *arg)
 
 			holdfd = open(ti->ti_pipename, O_RDONLY | O_NONBLOCK);
 
+			/* data sentinalpipe --drain read while we were down goes first */
+
+			if((rotate = spoolreplay(ti, filename)))
+				fprintf(stderr, "%s: rotate %s\n", ti->ti_section, ti->ti_filename);
+
 			/* begin */
 
-			ti->ti_sig = 0;							/* reset */
+			HUPRESET(ti);
+
+			/* a reload may stop this thread while it waits for input */
+
+			pthread_cleanup_push(wrkcancel, &ws);
+
+			for(n = 1; !rotate;) {
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				n = read(logfd, pipebuf, PIPEBUFSIZ);
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-			for(;;) {
-				if((n = read(logfd, pipebuf, PIPEBUFSIZ)) <= 0)
+				if(n <= 0)
 					break;
 
 				if(write(ti->ti_wfd, pipebuf, (size_t)n) == -1) {
@@ -199,15 +227,19 @@ void   *workthread(void *arg)
 					break;
 				}
 
-				if(ROTATE(ti->ti_rotatesiz, STAT(filename, stbuf), ti->ti_sig)) {
+				METRIC_ADD(ti, mt_wrkbytes, n);
+
+				if(ROTATE(ti->ti_rotatesiz, STAT(filename, stbuf), ti)) {
 					/* ti_rotatesiz or signaled to logrotate */
 
 					fprintf(stderr, "%s: rotate %s\n", ti->ti_section, ti->ti_filename);
-					ti->ti_sig = 0;					/* reset */
+					HUPRESET(ti);
 					break;
 				}
 			}
 
+			pthread_cleanup_pop(0);
+
 			/* done */
 
 			if(n == 0) {							/* writer is gone */
@@ -223,11 +255,10 @@ void   *workthread(void *arg)
 			/* No space left on device (cannot write compressed block) */
 
 			if(STAT(filename, stbuf) > 0) {			/* success */
-				if(NOT_NULL(ti->ti_postcmd))
-					if((status = postcmd(ti, filename)) != 0) {
-						fprintf(stderr, "%s: postcmd exit: %d\n", ti->ti_section, status);
-						sleep(5);					/* be nice */
-					}
+				METRIC_ADD(ti, mt_rotations, 1);
+
+				if(NOT_NULL(ti->ti_postcmd))		/* don't wait for it */
+					postqueue_submit(ti, filename);
 			} else {								/* fail */
 				remove(filename);					/* exists, CWE-367 N/A */
 				sleep(5);							/* be nice */
@@ -241,6 +272,92 @@ void   *workthread(void *arg)
 	return ((void *)0);
 }
 
+static void wrkcancel(void *arg)
+{
+	/* finish the current file as if the writer had gone */
+
+	int     status;									/* child status codes */
+	struct stat stbuf;								/* file status */
+	struct wrkstate *ws = arg;
+	struct thread_info *ti = ws->ws_ti;				/* shorthand */
+
+	close(ti->ti_wfd);
+	waitpid(ti->ti_pid, &status, 0);
+	ti->ti_wfd = EOF;
+
+	if(STAT(ws->ws_filename, stbuf) > 0)
+		postqueue_submit(ti, ws->ws_filename);
+	else
+		remove(ws->ws_filename);
+
+	close(*ws->ws_logfd);
+
+	if(*ws->ws_holdfd > 0)
+		close(*ws->ws_holdfd);
+}
+
+static bool spoolreplay(struct thread_info *ti, char *filename)
+{
+	/*
+	 * sentinalpipe appends under an exclusive flock and stops once our
+	 * pidfile is locked, so the spool is complete when we hold the lock
+	 * replay stops at rotatesiz like the FIFO loop, true = rotate now;
+	 * what was not written moves to the front of the spool for next time
+	 */
+
+	bool    rotate = false;							/* filename reached rotatesiz */
+	char    spool[PATH_MAX];
+	char   *map;
+	int     fd;
+	off_t   off;
+	size_t  len;									/* this write */
+	ssize_t n;
+	struct stat logbuf;								/* filename status */
+	struct stat stbuf;								/* file status */
+
+	snprintf(spool, PATH_MAX, "%s%s", ti->ti_pipename, SPOOLEXT);
+
+	if((fd = open(spool, O_RDWR | O_CLOEXEC)) == -1)
+		return (false);								/* nothing spooled */
+
+	if(flock(fd, LOCK_EX) == -1 || fstat(fd, &stbuf) == -1 || stbuf.st_size == 0) {
+		close(fd);
+		return (false);
+	}
+
+	if((map = mmap(NULL, stbuf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "%s: can't map %s\n", ti->ti_section, base(spool));
+		close(fd);
+		return (false);
+	}
+
+	madvise(map, stbuf.st_size, MADV_SEQUENTIAL);
+
+	for(off = 0; off < stbuf.st_size && !rotate; off += n) {
+		len = stbuf.st_size - off < PIPEBUFSIZ ? (size_t)(stbuf.st_size - off) : PIPEBUFSIZ;
+
+		if((n = write(ti->ti_wfd, map + off, len)) <= 0)
+			break;
+
+		METRIC_ADD(ti, mt_wrkbytes, n);
+		rotate = ROTATE(ti->ti_rotatesiz, STAT(filename, logbuf), ti);
+	}
+
+	fprintf(stderr, "%s: replayed %jd of %jd spooled bytes\n", ti->ti_section,
+			(intmax_t)off, (intmax_t)stbuf.st_size);
+
+	if(off > 0 && off < stbuf.st_size)				/* a command failed or rotate */
+		memmove(map, map + off, (size_t)(stbuf.st_size - off));
+
+	munmap(map, stbuf.st_size);
+
+	if(off > 0)										/* drop what was written */
+		ftruncate(fd, stbuf.st_size - off);
+
+	close(fd);										/* releases the flock */
+	return (rotate);
+}
+
 static void fifosize(struct thread_info *ti, int size)
 {
 	/* max pipesize is in /proc/sys/fs/pipe-max-size */
@@ -317,6 +434,10 @@ static int fifoopen(struct thread_info *ti)
 		}
 	}
 
+	/* blocks until a writer opens the FIFO */
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
 	while((fd = open(ti->ti_pipename, O_RDONLY)) == -1) {
 		if(errno == EINTR)
 			continue;
@@ -327,6 +448,8 @@ static int fifoopen(struct thread_info *ti)
 		break;
 	}
 
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
 	if(fd != -1) {
 		/* reinforce in case these were changed externally */
 